@@ -0,0 +1,156 @@
+#include <math.h>
+#include <time.h>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "../util/img.hpp"
+#include "../neural/nn.hpp"
+#include "../neural/cnn.hpp"
+#include "../neural/sparse_nn.hpp"
+#include "../neural/activations.hpp"
+
+#define NUMBER_TRAINING_IMGS 10000
+#define NUMBER_TEST_IMGS 3000
+#define MINI_BATCH_SIZE 50
+#define MAX_EPOCHS 10
+#define TARGET_ACCURACY 0.95
+// Runs of predict_imgs over the test images, the fastest one counting.
+#define PREDICT_RUNS 5
+
+typedef NeuralNetwork<float, 784, 300, 10> Net;
+typedef SparseNeuralNetwork<float, 784, 300, 10> SparseNet;
+typedef std::chrono::steady_clock Clock;
+
+// Train one epoch at a time until the test accuracy reaches TARGET_ACCURACY,
+// returns the training time in seconds (evaluation excluded).
+template<typename TrainEpoch>
+double time_to_accuracy(const char* name, Net& net, Img* test_imgs, std::function<float(const float&)>& activation, TrainEpoch train_epoch) {
+	double elapsed = 0;
+	for(std::size_t e = 1; e <= MAX_EPOCHS; e++) {
+		Clock::time_point start = Clock::now();
+		train_epoch(e);
+		elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+		double score = net.predict_imgs(test_imgs, NUMBER_TEST_IMGS, activation);
+		printf("%s: epoch %lu, %.2fs, score %2.3f%%\n", name, e, elapsed, score * 100);
+		if(score >= TARGET_ACCURACY) {
+			return elapsed;
+		}
+	}
+	printf("%s: target accuracy not reached in %d epochs\n", name, MAX_EPOCHS);
+	return elapsed;
+}
+
+// Time the Matrix::dot shapes of ConvNeuralNetwork<float, 8, 5, 2, 10> training on MINI_BATCH_SIZE mini batches
+// with the default kernel and with the one the autotuner picked, tuning it first with NN_AUTOTUNE=1.
+// Only the CNN multiplies matrices, the dense layers of NeuralNetwork going through Matrix::dot(Vector) which isn't tuned.
+// The CNN runs its dots inside the thread pool, so they are timed from a thread doing the same, on one thread.
+void bench_dot_kernels() {
+	// rows x inner x cols, with ld elements per row: convolution forward on the images of a batch,
+	// then the output layer delta and the pooled errors on CONV_BATCH_SIZE images
+	std::size_t conv_cols = ConvNeuralNetwork<float, 8, 5, 2, 10>::conv_batch_size(MINI_BATCH_SIZE) * 24 * 24;
+	std::size_t shapes[][4] = {
+		{ 8, 25, conv_cols, CONV_BATCH_SIZE * 24 * 24 }, { 10, 10, 1152, 1152 }
+	};
+	printf("Kernels (%s, %s autotuning, inside the pool)\n", Autotuner::instance().cpu_model().c_str(),
+		Autotuner::instance().mode() == AUTOTUNE_TUNE ? "with" : "without");
+	std::thread bench_thread([&]() {
+		ThreadPool::run_inline_in_this_thread();
+		for(auto& shape: shapes) {
+			std::size_t rows = shape[0], inner = shape[1], cols = shape[2], ld = shape[3];
+			std::vector<float> lhs(rows * inner), rhs(inner * ld), out(rows * ld);
+			for(float& e: lhs) {
+				e = (float)rand() / RAND_MAX;
+			}
+			for(float& e: rhs) {
+				e = (float)rand() / RAND_MAX;
+			}
+			DotConfig config = dot_config_for(lhs.data(), rhs.data(), out.data(), rows, inner, cols, ld);
+			double default_time = time_dot(lhs.data(), rhs.data(), out.data(), rows, inner, cols, ld, DotConfig());
+			double tuned_time = time_dot(lhs.data(), rhs.data(), out.data(), rows, inner, cols, ld, config);
+			printf("dot %lux%lux%lu: default %.3fms, tuned %.3fms, speedup x%.2f\n",
+				rows, inner, cols, default_time * 1000, tuned_time * 1000, default_time / tuned_time);
+		}
+	});
+	bench_thread.join();
+}
+
+// Seconds of the fastest of PREDICT_RUNS predictions of the test images, their accuracy in score.
+template<typename Network>
+double time_predict(const Network& net, Img* test_imgs, std::function<float(const float&)>& activation, double& score) {
+	double best = 0;
+	for(std::size_t run = 0; run < PREDICT_RUNS; run++) {
+		Clock::time_point start = Clock::now();
+		score = net.predict_imgs(test_imgs, NUMBER_TEST_IMGS, activation);
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		best = run == 0 ? elapsed : std::min(best, elapsed);
+	}
+	return best;
+}
+
+// Prune copies of the trained net to 80% and 90% sparsity, fine-tune them for one epoch, then compare
+// their test accuracy and the time of their sparse inference to the dense network's.
+void bench_pruning(const Net& net, Img* training_imgs, Img* test_imgs, float lr, std::function<float(const float&)>& activation, std::function<float(const float&)>& activation_prime) {
+	double dense_score;
+	double dense_time = time_predict(net, test_imgs, activation, dense_score);
+	printf("dense: score %2.3f%%, predict %.2fms\n", dense_score * 100, dense_time * 1000);
+	for(double sparsity: { 0.8, 0.9 }) {
+		Net* pruned_net = new Net(net);
+		pruned_net->prune(sparsity);
+		pruned_net->train_batch(training_imgs, 1, NUMBER_TRAINING_IMGS, MINI_BATCH_SIZE, lr, 1, activation, activation_prime);
+		SparseNet sparse_net(*pruned_net);
+		double sparse_score;
+		double sparse_time = time_predict(sparse_net, test_imgs, activation, sparse_score);
+		printf("pruned %2.0f%%: score %2.3f%% (%+.3f), sparse predict %.2fms, speedup x%.2f\n", sparse_net.sparsity() * 100,
+			sparse_score * 100, (sparse_score - dense_score) * 100, sparse_time * 1000, dense_time / sparse_time);
+		delete pruned_net;
+	}
+}
+
+int main() {
+	bench_dot_kernels();
+
+	Img* training_imgs;
+	Img* test_imgs;
+	if(csv_to_imgs(&training_imgs, "./data/mnist_train.csv", NUMBER_TRAINING_IMGS) || csv_to_imgs(&test_imgs, "./data/mnist_test.csv", NUMBER_TEST_IMGS)) {
+		printf("An error happened while loading the imgs.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	std::function<float(const float&)> activation = [](auto x) {
+		return relu(x);
+	};
+	std::function<float(const float&)> activation_prime = [](auto x) {
+		return relu_prime(x);
+	};
+	std::size_t n_threads = ThreadPool::instance().size();
+	float lr = 0.1, lr_coef = 0.9;
+
+	// heap allocated, the weights being too large for the stack once several networks are alive
+	srand(42);
+	Net* sync_net = new Net();
+	float sync_lr = lr;
+	double sync_time = time_to_accuracy("sync", *sync_net, test_imgs, activation, [&](std::size_t) {
+		sync_net->train_batch(training_imgs, 1, NUMBER_TRAINING_IMGS, MINI_BATCH_SIZE, sync_lr, lr_coef, activation, activation_prime);
+		sync_lr *= lr_coef;
+	});
+
+	srand(42);
+	Net* hogwild_net = new Net();
+	float hogwild_lr = lr;
+	double hogwild_time = time_to_accuracy("hogwild", *hogwild_net, test_imgs, activation, [&](std::size_t) {
+		hogwild_net->train_batch_hogwild(training_imgs, 1, NUMBER_TRAINING_IMGS, MINI_BATCH_SIZE, hogwild_lr, lr_coef, activation, activation_prime);
+		hogwild_lr *= lr_coef;
+	});
+
+	printf("Time to %2.1f%%: sync %.2fs, hogwild (%lu threads) %.2fs, speedup x%.2f\n",
+		TARGET_ACCURACY * 100, sync_time, n_threads, hogwild_time, sync_time / hogwild_time);
+
+	bench_pruning(*sync_net, training_imgs, test_imgs, sync_lr, activation, activation_prime);
+
+	delete sync_net;
+	delete hogwild_net;
+	imgs_free(training_imgs, NUMBER_TRAINING_IMGS);
+	imgs_free(test_imgs, NUMBER_TEST_IMGS);
+	return EXIT_SUCCESS;
+}
@@ -1,14 +1,75 @@
 #include <math.h>
+#include <string.h>
 #include <time.h>
+#include <chrono>
 #include <iostream>
 #include "util/img.hpp"
 #include "neural/nn.hpp"
+#include "neural/sparse_nn.hpp"
+#include "neural/cnn.hpp"
 #include "neural/activations.hpp"
 
 
 #define SAVE_FILE_NAME "./testing_net/bin"
 
-int main() {
+// Ways to train, picked by the first argument (train by default).
+static const char* MODES[] = { "train", "hogwild", "distributed", "prune", "cnn", "augment", "validate" };
+
+typedef NeuralNetwork<float, 784, 300, 10> Net;
+typedef std::chrono::steady_clock Clock;
+
+// Prune the trained net to 85% sparsity and fine-tune it for one epoch, then compare the test score
+// and the inference time of its sparse copy to the ones of the dense network.
+static void prune_and_compare(Net& net, Img* training_imgs, size_t number_training_imgs, std::function<float(const float&)>& activation, std::function<float(const float&)>& activation_prime) {
+	size_t number_test_imgs = 3000;
+	Img* test_imgs;
+	if(csv_to_imgs(&test_imgs, "data/mnist_test.csv", number_test_imgs)) {
+		printf("An error appened while loading the imgs.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	Clock::time_point start = Clock::now();
+	double score = net.predict_imgs(test_imgs, number_test_imgs, activation);
+	double dense_time = std::chrono::duration<double>(Clock::now() - start).count();
+	printf("Score: %2.3f%%\n", score * 100);
+
+	printf("pruning\n");
+	net.prune(0.85);
+	net.train_batch(training_imgs, 1, number_training_imgs, 50, 0.1, 0.9, activation, activation_prime);
+	SparseNeuralNetwork<float, 784, 300, 10> sparse_net(net);
+	start = Clock::now();
+	double sparse_score = sparse_net.predict_imgs(test_imgs, number_test_imgs, activation);
+	double sparse_time = std::chrono::duration<double>(Clock::now() - start).count();
+	printf("Sparsity: %2.1f%%, Score: %2.3f%% (delta %+2.3f%%), Inference speedup: x%.2f\n",
+		sparse_net.sparsity() * 100, sparse_score * 100, (sparse_score - score) * 100, dense_time / sparse_time);
+
+	imgs_free(test_imgs, number_test_imgs);
+}
+
+static bool is_mode(const char* name) {
+	for(const char* mode: MODES) {
+		if(strcmp(name, mode) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void usage(const char* exec) {
+	fprintf(stderr, "Usage: %s [mode], mode being one of:", exec);
+	for(const char* mode: MODES) {
+		fprintf(stderr, " %s", mode);
+	}
+	fprintf(stderr, "\n");
+	fprintf(stderr, "distributed takes <rank> <world size> [host], every rank running its own process on host\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv) {
+	const char* mode = argc > 1 ? argv[1] : MODES[0];
+	if(!is_mode(mode) || (strcmp(mode, "distributed") == 0 && argc < 4)) {
+		usage(argv[0]);
+	}
 	srand(time(NULL));
 
 	//TRAINING
@@ -28,8 +89,40 @@ int main() {
 		return relu_prime(x);
 	};
 
-	NeuralNetwork<float, 784, 300, 10> net;
-	net.train_batch(training_imgs, epochs, number_training_imgs, 50, 0.7, 0.9, activation, activation_prime);
+	Net net;
+	if(strcmp(mode, "train") == 0) {
+		net.train_batch(training_imgs, epochs, number_training_imgs, 50, 0.7, 0.9, activation, activation_prime);
+	} else if(strcmp(mode, "prune") == 0) {
+		net.train_batch(training_imgs, epochs, number_training_imgs, 50, 0.7, 0.9, activation, activation_prime);
+		prune_and_compare(net, training_imgs, number_training_imgs, activation, activation_prime);
+	} else if(strcmp(mode, "cnn") == 0) {
+		// 8 filters of 5x5 and 2x2 max pooling, replacing the dense network
+		ConvNeuralNetwork<float, 8, 5, 2, 10>* cnn = new ConvNeuralNetwork<float, 8, 5, 2, 10>();
+		cnn->train_batch(training_imgs, epochs, number_training_imgs, 50, 0.1, 0.9, activation, activation_prime);
+		delete cnn;
+	} else if(strcmp(mode, "augment") == 0) {
+		// shifted/rotated/elastic/noisy images prepared on a background thread
+		AugmentParams augment_params;
+		augment_params.seed = 42;
+		net.train_batch_augmented(training_imgs, epochs, number_training_imgs, 50, 0.7, 0.9, activation, activation_prime, augment_params);
+	} else if(strcmp(mode, "validate") == 0) {
+		// validating every 50 mini batches on held-out images, stopping after 3 validations
+		// without improvement and keeping the best weights
+		Img* validation_imgs;
+		if(csv_to_imgs(&validation_imgs, "./data/mnist_train.csv", 2000)) {
+			printf("An error happened while loading the imgs.\n");
+			exit(EXIT_FAILURE);
+		}
+		net.train_batch_validated(training_imgs, epochs, number_training_imgs, 50, 0.7, 0.9, activation, activation_prime, validation_imgs, 2000, 50, 3);
+		imgs_free(validation_imgs, 2000);
+	} else if(strcmp(mode, "hogwild") == 0) {
+		// asynchronous, the threads of the pool updating the weights without any lock
+		net.train_batch_hogwild(training_imgs, epochs, number_training_imgs, 50, 0.7, 0.9, activation, activation_prime);
+	} else if(strcmp(mode, "distributed") == 0) {
+		// data parallel, every rank training on its shard of the images and all-reducing the gradients
+		TcpTransport transport(atoi(argv[2]), atoi(argv[3]), argc > 4 ? argv[4] : "127.0.0.1", 29500);
+		net.train_batch_distributed(transport, training_imgs, epochs, number_training_imgs, 50, 0.7, 0.9, activation, activation_prime);
+	}
 
 	// {
 	// 	std::ofstream output_file(SAVE_FILE_NAME, std::ios::out | std::ios::binary | std::ios::trunc);
@@ -39,8 +132,6 @@ int main() {
 	// 	net.save_binary(output_file);
 	// 	output_file.close();
 	// }
-	
-	imgs_free(training_imgs, number_training_imgs);
 
 	// PREDICTING
 	// printf("predicting\n");
@@ -54,6 +145,7 @@ int main() {
 	// double score = net.predict_imgs(test_imgs, number_test_imgs, activation);
 	// printf("Score: %2.3f%%\n", score * 100);
 	// imgs_free(test_imgs, number_test_imgs);
+	imgs_free(training_imgs, number_training_imgs);
 
 	return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <stdio.h>
+#include <string>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include "../util/autotune.hpp"
+#include "../util/thread_pool.hpp"
+
+// Timed runs of every candidate kernel, after a warm-up run, the fastest run counting.
+#define DOT_TUNING_RUNS 3
+// Speedup a candidate needs over the best kernel so far to replace it, below which the difference is mostly noise.
+#define DOT_TUNING_MIN_GAIN 1.05
+// Rounds of DOT_TUNING_RUNS runs of the default kernel and of the winner, alternated, the winner only being kept
+// when its fastest round still beats the fastest round of the default kernel by DOT_TUNING_MIN_GAIN.
+#define DOT_TUNING_CONFIRM_ROUNDS 5
+
+template<typename T>
+const char* dtype_name() {
+	return typeid(T).name();
+}
+
+template<>
+inline const char* dtype_name<float>() {
+	return "float";
+}
+
+template<>
+inline const char* dtype_name<double>() {
+	return "double";
+}
+
+// out[i_begin:i_end, j_begin:j_end] = lhs[i_begin:i_end, :] . rhs[:, j_begin:j_end] for a row major rows x inner lhs,
+// rhs and out being row major with ld elements per row, skipping the zero elements of lhs (e.g. inactive relu neurons),
+// which thus contribute 0 even facing an infinite or NaN element of rhs.
+// Every config sums each output element over k in increasing order, so they all give the same bits.
+template<typename T>
+void dot_region(
+	const T* lhs, const T* rhs, T* out, std::size_t inner, std::size_t ld,
+	std::size_t i_begin, std::size_t i_end, std::size_t j_begin, std::size_t j_end,
+	const DotConfig& config
+) {
+	if(j_begin >= j_end) {
+		return;
+	}
+	for(std::size_t i = i_begin; i < i_end; i++) {
+		for(std::size_t j = j_begin; j < j_end; j++) {
+			out[i * ld + j] = T();
+		}
+	}
+	std::size_t tile_j = config.tile_j == 0 ? j_end - j_begin : config.tile_j;
+	std::size_t tile_k = config.tile_k == 0 ? inner : config.tile_k;
+	if(config.order == DOT_ORDER_ROWS) {
+		for(std::size_t i = i_begin; i < i_end; i++) {
+			T* out_row = out + i * ld;
+			for(std::size_t jj = j_begin; jj < j_end; jj += tile_j) {
+				std::size_t jj_end = std::min(jj + tile_j, j_end);
+				for(std::size_t k = 0; k < inner; k++) {
+					T lhs_elem = lhs[i * inner + k];
+					if(lhs_elem == T()) {
+						continue;
+					}
+					const T* rhs_row = rhs + k * ld;
+					for(std::size_t j = jj; j < jj_end; j++) {
+						out_row[j] += lhs_elem * rhs_row[j];
+					}
+				}
+			}
+		}
+	} else {
+		for(std::size_t jj = j_begin; jj < j_end; jj += tile_j) {
+			std::size_t jj_end = std::min(jj + tile_j, j_end);
+			for(std::size_t kk = 0; kk < inner; kk += tile_k) {
+				std::size_t kk_end = std::min(kk + tile_k, inner);
+				for(std::size_t i = i_begin; i < i_end; i++) {
+					T* out_row = out + i * ld;
+					for(std::size_t k = kk; k < kk_end; k++) {
+						T lhs_elem = lhs[i * inner + k];
+						if(lhs_elem == T()) {
+							continue;
+						}
+						const T* rhs_row = rhs + k * ld;
+						for(std::size_t j = jj; j < jj_end; j++) {
+							out_row[j] += lhs_elem * rhs_row[j];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+// The first cols columns of out = lhs . rhs, rhs and out having ld >= cols elements per row.
+// Inside the thread pool the blocks of a split would run one after the other, so the whole product is computed at once.
+template<typename T>
+void dot_with_config(const T* lhs, const T* rhs, T* out, std::size_t rows, std::size_t inner, std::size_t cols, std::size_t ld, const DotConfig& config) {
+	ThreadPool& pool = ThreadPool::instance();
+	if(pool.available_threads() == 1) {
+		dot_region(lhs, rhs, out, inner, ld, 0, rows, 0, cols, config);
+	} else if(config.split == DOT_SPLIT_ROWS) {
+		pool.parallel_for(rows, [&](std::size_t begin, std::size_t end) {
+			dot_region(lhs, rhs, out, inner, ld, begin, end, 0, cols, config);
+		}, ThreadPool::grain_for(inner * cols));
+	} else if(config.split == DOT_SPLIT_COLS) {
+		pool.parallel_for(cols, [&](std::size_t begin, std::size_t end) {
+			dot_region(lhs, rhs, out, inner, ld, 0, rows, begin, end, config);
+		}, ThreadPool::grain_for(rows * inner));
+	} else {
+		dot_region(lhs, rhs, out, inner, ld, 0, rows, 0, cols, config);
+	}
+}
+
+// Kernels tried by the autotuner, the splits only being tried when several threads are available
+// (a single thread running every split the same way, see dot_with_config).
+inline std::vector<DotConfig> dot_candidates(std::size_t inner, std::size_t cols, std::size_t n_threads) {
+	std::vector<std::size_t> tiles_j = { 0 };
+	for(std::size_t tile: { 16, 64, 256, 1024 }) {
+		if(tile < cols) {
+			tiles_j.push_back(tile);
+		}
+	}
+	std::vector<std::size_t> tiles_k = { 0 };
+	for(std::size_t tile: { 16, 64, 256 }) {
+		if(tile < inner) {
+			tiles_k.push_back(tile);
+		}
+	}
+	std::vector<DotSplit> splits = { DotConfig().split };
+	if(n_threads > 1) {
+		splits = { DOT_SPLIT_ROWS, DOT_SPLIT_COLS, DOT_SPLIT_NONE };
+	}
+
+	std::vector<DotConfig> candidates;
+	for(DotSplit split: splits) {
+		DotConfig config;
+		config.split = split;
+		config.order = DOT_ORDER_ROWS;
+		for(std::size_t tile_j: tiles_j) {
+			config.tile_j = tile_j;
+			candidates.push_back(config);
+		}
+		config.order = DOT_ORDER_TILES;
+		for(std::size_t tile_k: tiles_k) {
+			for(std::size_t tile_j: tiles_j) {
+				// without any tile, the same loops as DOT_ORDER_ROWS
+				if(tile_k == 0 && tile_j == 0) {
+					continue;
+				}
+				config.tile_k = tile_k;
+				config.tile_j = tile_j;
+				candidates.push_back(config);
+			}
+		}
+	}
+	return candidates;
+}
+
+// Seconds of the fastest of DOT_TUNING_RUNS runs of config.
+template<typename T>
+double time_dot(const T* lhs, const T* rhs, T* out, std::size_t rows, std::size_t inner, std::size_t cols, std::size_t ld, const DotConfig& config) {
+	typedef std::chrono::steady_clock Clock;
+	dot_with_config(lhs, rhs, out, rows, inner, cols, ld, config);
+	double best = 0;
+	for(std::size_t run = 0; run < DOT_TUNING_RUNS; run++) {
+		Clock::time_point start = Clock::now();
+		dot_with_config(lhs, rhs, out, rows, inner, cols, ld, config);
+		double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		best = run == 0 ? elapsed : std::min(best, elapsed);
+	}
+	return best;
+}
+
+// Benchmark every candidate on the actual operands, then confirm the winner against the default kernel,
+// out ending up holding the product.
+template<typename T>
+DotConfig tune_dot(const T* lhs, const T* rhs, T* out, std::size_t rows, std::size_t inner, std::size_t cols, std::size_t ld, std::size_t n_threads) {
+	DotConfig default_config;
+	DotConfig best_config = default_config;
+	double default_time = time_dot(lhs, rhs, out, rows, inner, cols, ld, default_config);
+	double best_time = default_time;
+	for(const DotConfig& config: dot_candidates(inner, cols, n_threads)) {
+		if(config == default_config) {
+			continue;
+		}
+		double elapsed = time_dot(lhs, rhs, out, rows, inner, cols, ld, config);
+		if(elapsed * DOT_TUNING_MIN_GAIN < best_time) {
+			best_time = elapsed;
+			best_config = config;
+		}
+	}
+	// the sweep may crown a candidate that was only lucky once, so both are timed again from scratch
+	if(!(best_config == default_config)) {
+		for(std::size_t round = 0; round < DOT_TUNING_CONFIRM_ROUNDS; round++) {
+			double round_default_time = time_dot(lhs, rhs, out, rows, inner, cols, ld, default_config);
+			double round_best_time = time_dot(lhs, rhs, out, rows, inner, cols, ld, best_config);
+			default_time = round == 0 ? round_default_time : std::min(default_time, round_default_time);
+			best_time = round == 0 ? round_best_time : std::min(best_time, round_best_time);
+		}
+		if(best_time * DOT_TUNING_MIN_GAIN >= default_time) {
+			best_config = default_config;
+			best_time = default_time;
+		}
+	}
+	printf("Tuned dot %lux%lux%lu %s on %lu threads: order %d, split %d, tile_k %lu, tile_j %lu, x%.2f over the default kernel\n",
+		rows, inner, cols, dtype_name<T>(), n_threads, (int)best_config.order, (int)best_config.split,
+		best_config.tile_k, best_config.tile_j, default_time / best_time);
+	return best_config;
+}
+
+// Operands of a dot as keyed by the autotuner, along with the mode its kernel was looked up in.
+struct DotShape {
+	std::size_t rows;
+	std::size_t inner;
+	std::size_t cols;
+	std::size_t n_threads;
+	AutotuneMode mode;
+
+	bool operator==(const DotShape& other) const {
+		return this->rows == other.rows && this->inner == other.inner && this->cols == other.cols
+			&& this->n_threads == other.n_threads && this->mode == other.mode;
+	}
+};
+
+// Kernel the autotuner picked for this shape, dtype and number of available threads.
+// Every thread remembers the kernels it already looked up (a network only using a handful of shapes),
+// so the autotuner, its lock and its string keys are only hit once per thread and shape.
+template<typename T>
+DotConfig dot_config_for(const T* lhs, const T* rhs, T* out, std::size_t rows, std::size_t inner, std::size_t cols, std::size_t ld) {
+	Autotuner& autotuner = Autotuner::instance();
+	AutotuneMode mode = autotuner.mode();
+	if(mode == AUTOTUNE_OFF) {
+		return DotConfig();
+	}
+	std::size_t n_threads = ThreadPool::instance().available_threads();
+	DotShape key = { rows, inner, cols, n_threads, mode };
+	static thread_local std::vector<std::pair<DotShape, DotConfig>> known;
+	for(const auto& entry: known) {
+		if(entry.first == key) {
+			return entry.second;
+		}
+	}
+	std::string shape = std::to_string(rows) + 'x' + std::to_string(inner) + 'x' + std::to_string(cols)
+		+ ' ' + dtype_name<T>() + ' ' + std::to_string(n_threads);
+	DotConfig config = autotuner.dot_config(shape, [&]() {
+		return tune_dot(lhs, rhs, out, rows, inner, cols, ld, n_threads);
+	});
+	known.emplace_back(key, config);
+	return config;
+}
+
+template<typename T>
+void dot_tuned(const T* lhs, const T* rhs, T* out, std::size_t rows, std::size_t inner, std::size_t cols, std::size_t ld) {
+	dot_with_config(lhs, rhs, out, rows, inner, cols, ld, dot_config_for(lhs, rhs, out, rows, inner, cols, ld));
+}
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <vector>
+
+#include "dot_kernel.hpp"
 #include "vector.hpp"
+#include "../util/thread_pool.hpp"
 
 template <typename T, std::size_t ROWS, std::size_t COLS>
 class Matrix {
@@ -42,6 +46,15 @@ public:
 		return out;
 	}
 
+	// Rows are stored contiguously, the whole matrix being ROWS * COLS contiguous elements.
+	T* raw_data() {
+		return (T*)this->data;
+	}
+
+	const T* raw_data() const {
+		return (const T*)this->data;
+	}
+
 	Vector<T, COLS>& operator[](size_t i) {
 		if(i >= ROWS) {
 			throw std::out_of_range(string_format("Tried to access row %lu but the matrix has %lu rows.", i, ROWS));
@@ -176,33 +189,109 @@ public:
 		return *this;
 	}
 
+	// this += rhs * scale, skipping the zero elements of rhs and the elements where mask (if any) is false.
+	// Elements are updated with a relaxed atomic load then store so that concurrent (Hogwild) updates
+	// never tear a value, at the cost of possibly losing one of two simultaneous updates of an element.
+	void add_scaled_relaxed(const Matrix<T, ROWS, COLS>& rhs, const T& scale, const Matrix<bool, ROWS, COLS>* mask = nullptr) {
+		for (size_t row = 0; row < ROWS; row++) {
+			for(size_t col = 0; col < COLS; col++) {
+				const T& delta = rhs[row][col];
+				if(delta == T() || (mask && !(*mask)[row][col])) {
+					continue;
+				}
+				T* e = &this->data[row][col];
+				T cur;
+				__atomic_load(e, &cur, __ATOMIC_RELAXED);
+				cur += delta * scale;
+				__atomic_store(e, &cur, __ATOMIC_RELAXED);
+			}
+		}
+	}
+
 	template<size_t RHS_ROWS, size_t RHS_COLS>
 	Matrix<T, ROWS, RHS_COLS> dot(const Matrix<T, RHS_ROWS, RHS_COLS>& rhs) const {
+		Matrix<T, ROWS, RHS_COLS> out;
+		dot(rhs, out);
+		return out;
+	}
+
+	// Same as dot but writing into out, for the matrices too large to be returned by value.
+	// Only the first n_cols columns of out are computed from the first n_cols columns of rhs
+	// (e.g. the images of a partial batch), the other columns of out being left untouched.
+	// The loop order, tiles and thread split come from the autotuner (see dot_kernel.hpp),
+	// every kernel skipping the zero elements of this (e.g. inactive relu neurons).
+	template<size_t RHS_ROWS, size_t RHS_COLS>
+	void dot(const Matrix<T, RHS_ROWS, RHS_COLS>& rhs, Matrix<T, ROWS, RHS_COLS>& out, std::size_t n_cols = RHS_COLS) const {
 		if (COLS != RHS_ROWS) {
 			throw std::invalid_argument(string_format("Dot product dimension mismatch, lhs COLS (%lu) != rhs ROWS (%lu)", COLS, RHS_ROWS));
 		}
-		Matrix<T, ROWS, RHS_COLS> out;
-		for (size_t i = 0; i < ROWS; i++) {
-			for (size_t j = 0; j < RHS_COLS; j++) {
-				T sum = T();
-				for (size_t k = 0; k < RHS_ROWS; k++) {
-					sum += this->data[i][k] * rhs[k][j];
+		if (n_cols > RHS_COLS) {
+			throw std::invalid_argument(string_format("Tried to compute %lu columns of a dot product with %lu columns", n_cols, RHS_COLS));
+		}
+		dot_tuned(this->raw_data(), rhs.raw_data(), out.raw_data(), ROWS, COLS, n_cols, RHS_COLS);
+	}
+
+	// this.dot(rhs.transpose()) without building the transpose, both operands being read row by row.
+	// Only the first n_cols columns of both operands are summed over.
+	template<size_t RHS_ROWS>
+	void dot_transposed(const Matrix<T, RHS_ROWS, COLS>& rhs, Matrix<T, ROWS, RHS_ROWS>& out, std::size_t n_cols = COLS) const {
+		if (n_cols > COLS) {
+			throw std::invalid_argument(string_format("Tried to sum %lu columns of matrices with %lu columns", n_cols, COLS));
+		}
+		const T* lhs_data = this->raw_data();
+		const T* rhs_data = rhs.raw_data();
+		T* out_data = out.raw_data();
+		ThreadPool::instance().parallel_for(ROWS, [&](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) {
+				const T* lhs_row = lhs_data + i * COLS;
+				for (size_t j = 0; j < RHS_ROWS; j++) {
+					const T* rhs_row = rhs_data + j * COLS;
+					T sum = T();
+					for (size_t k = 0; k < n_cols; k++) {
+						sum += lhs_row[k] * rhs_row[k];
+					}
+					out_data[i * RHS_ROWS + j] = sum;
 				}
-				out[i][j] = sum;
 			}
+		}, ThreadPool::grain_for(RHS_ROWS * n_cols));
+	}
+
+	// The zero elements of rhs (e.g. inactive relu neurons, black pixels) are skipped when sparse enough,
+	// so unlike IEEE arithmetic they contribute 0 even facing an infinite or NaN weight.
+	Vector<T, ROWS> dot(const Vector<T, COLS>& rhs) const {
+		std::size_t* indices = Vector<T, COLS>::index_buffer();
+		std::size_t n_nonzero = rhs.nonzero_indices(indices);
+		if(rhs.is_sparse(n_nonzero)) {
+			return dot_sparse(rhs, indices, n_nonzero);
 		}
+		Vector<T, ROWS> out;
+		ThreadPool::instance().parallel_for(ROWS, [&](size_t begin, size_t end) {
+			for(size_t row = begin; row < end; row++) {
+				T sum = T();
+				for(size_t col = 0; col < COLS; col++) {
+					sum += this->data[row][col] * rhs[col];
+				}
+				out[row] = sum;
+			}
+		}, ThreadPool::grain_for(COLS));
 		return out;
 	}
 
-	Vector<T, ROWS> dot(const Vector<T, COLS>& rhs) const {
+	// Only visit the columns matching the non zero elements of rhs,
+	// indices being the output of rhs.nonzero_indices.
+	Vector<T, ROWS> dot_sparse(const Vector<T, COLS>& rhs, const std::size_t* indices, std::size_t n_nonzero) const {
 		Vector<T, ROWS> out;
-		for(size_t row = 0; row < ROWS; row++) {
-			T sum = T();
-			for(size_t col = 0; col < COLS; col++) {
-				sum += this->data[row][col] * rhs[col];
+		ThreadPool::instance().parallel_for(ROWS, [&](size_t begin, size_t end) {
+			for(size_t row = begin; row < end; row++) {
+				const Vector<T, COLS>& cur_row = this->data[row];
+				T sum = T();
+				for(size_t i = 0; i < n_nonzero; i++) {
+					size_t col = indices[i];
+					sum += cur_row[col] * rhs[col];
+				}
+				out[row] = sum;
 			}
-			out[row] = sum;
-		}
+		}, ThreadPool::grain_for(n_nonzero));
 		return out;
 	}
 
@@ -236,6 +325,60 @@ public:
 		return out;
 	}
 
+	std::size_t count_nonzero() const {
+		std::size_t count = 0;
+		for (size_t row = 0; row < ROWS; row++) {
+			for(size_t col = 0; col < COLS; col++) {
+				if(this->data[row][col] != T()) {
+					count++;
+				}
+			}
+		}
+		return count;
+	}
+
+	// Append the absolute value of every element to out.
+	void magnitudes(std::vector<T>& out) const {
+		out.reserve(out.size() + ROWS * COLS);
+		for (size_t row = 0; row < ROWS; row++) {
+			for(size_t col = 0; col < COLS; col++) {
+				out.push_back(std::abs(this->data[row][col]));
+			}
+		}
+	}
+
+	// Zero every element whose magnitude is strictly under threshold.
+	void prune(const T& threshold) {
+		for (size_t row = 0; row < ROWS; row++) {
+			for(size_t col = 0; col < COLS; col++) {
+				if(std::abs(this->data[row][col]) < threshold) {
+					this->data[row][col] = T();
+				}
+			}
+		}
+	}
+
+	Matrix<bool, ROWS, COLS> nonzero_mask() const {
+		Matrix<bool, ROWS, COLS> out;
+		for (size_t row = 0; row < ROWS; row++) {
+			for(size_t col = 0; col < COLS; col++) {
+				out[row][col] = this->data[row][col] != T();
+			}
+		}
+		return out;
+	}
+
+	// Zero every element where mask is false, used to keep pruned weights at zero while fine-tuning.
+	void apply_mask(const Matrix<bool, ROWS, COLS>& mask) {
+		for (size_t row = 0; row < ROWS; row++) {
+			for(size_t col = 0; col < COLS; col++) {
+				if(!mask[row][col]) {
+					this->data[row][col] = T();
+				}
+			}
+		}
+	}
+
 	std::ofstream& save_binary(std::ofstream& out) const {
 		std::size_t rows = ROWS, cols = COLS;
         out.write((const char*)&rows, sizeof(std::size_t));
@@ -278,4 +421,17 @@ private:
 	}
 
 	Vector<T, COLS> data[ROWS];
-};
\ No newline at end of file
+};
+template<typename T, std::size_t ROWS, std::size_t COLS>
+std::size_t partial_rows(const Matrix<T, ROWS, COLS>&) {
+	return ROWS;
+}
+
+template<typename T, std::size_t ROWS, std::size_t COLS>
+void add_partial_rows(Matrix<T, ROWS, COLS>& out, const Matrix<T, ROWS, COLS>& in, std::size_t begin, std::size_t end) {
+	T* out_data = out.raw_data();
+	const T* in_data = in.raw_data();
+	for(std::size_t i = begin * COLS; i < end * COLS; i++) {
+		out_data[i] += in_data[i];
+	}
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "matrix.hpp"
+
+// Compressed Sparse Column storage, only keeping the non zero elements of a (pruned) matrix.
+// Column j spans values[col_ptr[j]..col_ptr[j + 1]), row_indices giving the row of each value.
+// Column major so that dot can also skip the columns matching the zero elements of its input.
+template <typename T, std::size_t ROWS, std::size_t COLS>
+class SparseMatrix {
+public:
+
+	SparseMatrix(const Matrix<T, ROWS, COLS>& mat) {
+		std::size_t nnz = mat.count_nonzero();
+		this->row_indices.reserve(nnz);
+		this->values.reserve(nnz);
+		this->col_ptr[0] = 0;
+		for(std::size_t col = 0; col < COLS; col++) {
+			for(std::size_t row = 0; row < ROWS; row++) {
+				const T& e = mat[row][col];
+				if(e != T()) {
+					this->row_indices.push_back((std::uint32_t)row);
+					this->values.push_back(e);
+				}
+			}
+			this->col_ptr[col + 1] = this->values.size();
+		}
+	}
+
+	SparseMatrix(std::ifstream& in) {
+		std::size_t rows, cols, nnz;
+		in.read((char*)&rows, sizeof(std::size_t));
+		in.read((char*)&cols, sizeof(std::size_t));
+		in.read((char*)&nnz, sizeof(std::size_t));
+		if(!in) {
+			throw std::invalid_argument("Truncated SparseMatrix binary file, unable to read its header");
+		}
+		std::cout << "SparseMatrix init with " << rows << " rows, " << cols << " columns and " << nnz << " non zero elements" << std::endl;
+		if(rows != ROWS || cols != COLS) {
+			throw std::invalid_argument(string_format("Tried to initialize a %lux%lu SparseMatrix but binary file contain %lux%lu SparseMatrix", ROWS, COLS, rows, cols));
+		}
+		if(nnz > ROWS * COLS) {
+			throw std::invalid_argument(string_format("Binary file contain a %lux%lu SparseMatrix with %lu non zero elements", ROWS, COLS, nnz));
+		}
+		this->row_indices.resize(nnz);
+		this->values.resize(nnz);
+		in.read((char*)this->col_ptr, sizeof(std::size_t) * (COLS + 1));
+		in.read((char*)this->row_indices.data(), sizeof(std::uint32_t) * nnz);
+		in.read((char*)this->values.data(), sizeof(T) * nnz);
+		if(!in) {
+			throw std::invalid_argument(string_format("Truncated SparseMatrix binary file, unable to read its %lu non zero elements", nnz));
+		}
+		// dot and to_dense index through col_ptr and row_indices without any check
+		if(this->col_ptr[0] != 0 || this->col_ptr[COLS] != nnz) {
+			throw std::invalid_argument("Corrupted SparseMatrix binary file, column pointers don't match the number of elements");
+		}
+		for(std::size_t col = 0; col < COLS; col++) {
+			if(this->col_ptr[col] > this->col_ptr[col + 1]) {
+				throw std::invalid_argument(string_format("Corrupted SparseMatrix binary file, column pointers decrease at column %lu", col));
+			}
+		}
+		for(std::size_t i = 0; i < nnz; i++) {
+			if(this->row_indices[i] >= ROWS) {
+				throw std::invalid_argument(string_format("Corrupted SparseMatrix binary file, row index %u out of %lu rows", this->row_indices[i], ROWS));
+			}
+		}
+	}
+
+	Vector<T, ROWS> dot(const Vector<T, COLS>& rhs) const {
+		T sums[ROWS] = {};
+		const std::uint32_t* rows = this->row_indices.data();
+		const T* vals = this->values.data();
+		for(std::size_t col = 0; col < COLS; col++) {
+			const T& x = rhs[col];
+			if(x == T()) {
+				continue;
+			}
+			for(std::size_t i = this->col_ptr[col]; i < this->col_ptr[col + 1]; i++) {
+				sums[rows[i]] += vals[i] * x;
+			}
+		}
+		Vector<T, ROWS> out;
+		for(std::size_t row = 0; row < ROWS; row++) {
+			out[row] = sums[row];
+		}
+		return out;
+	}
+
+	Matrix<T, ROWS, COLS> to_dense() const {
+		Matrix<T, ROWS, COLS> out(0);
+		for(std::size_t col = 0; col < COLS; col++) {
+			for(std::size_t i = this->col_ptr[col]; i < this->col_ptr[col + 1]; i++) {
+				out[this->row_indices[i]][col] = this->values[i];
+			}
+		}
+		return out;
+	}
+
+	std::size_t count_nonzero() const {
+		return this->values.size();
+	}
+
+	double density() const {
+		return 1.0 * this->values.size() / (ROWS * COLS);
+	}
+
+	std::ofstream& save_binary(std::ofstream& out) const {
+		std::size_t rows = ROWS, cols = COLS, nnz = this->values.size();
+		out.write((const char*)&rows, sizeof(std::size_t));
+		out.write((const char*)&cols, sizeof(std::size_t));
+		out.write((const char*)&nnz, sizeof(std::size_t));
+		out.write((const char*)this->col_ptr, sizeof(std::size_t) * (COLS + 1));
+		out.write((const char*)this->row_indices.data(), sizeof(std::uint32_t) * nnz);
+		out.write((const char*)this->values.data(), sizeof(T) * nnz);
+		return out;
+	}
+
+private:
+	std::size_t col_ptr[COLS + 1];
+	std::vector<std::uint32_t> row_indices;
+	std::vector<T> values;
+};
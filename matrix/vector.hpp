@@ -12,8 +12,16 @@
 
 #include <functional>
 #include <initializer_list>
+#include <vector>
 #include <fstream>
 
+#include "fast_exp.hpp"
+#include "../util/thread_pool.hpp"
+
+// Above this ratio of non zero elements the sparse kernels fall back to the dense loops,
+// the index bookkeeping costing more than the skipped multiplications.
+#define SPARSE_DENSITY_THRESHOLD 0.5
+
 template <typename T, std::size_t ROWS, std::size_t COLS>
 class Matrix;
 
@@ -74,26 +82,96 @@ public:
     template<std::size_t RHS_SIZE>
     Matrix<T, SIZE, RHS_SIZE> dot(const Vector<T, RHS_SIZE>& rhs) const {
         Matrix<T, SIZE, RHS_SIZE> out;
-        for(std::size_t row = 0; row < SIZE; row++) {
-            for(std::size_t col = 0; col < RHS_SIZE; col++) {
-                out[row][col] = this->data[row] * rhs[col];
+        std::size_t* indices = Vector<T, RHS_SIZE>::index_buffer();
+        std::size_t n_nonzero = rhs.nonzero_indices(indices);
+        bool sparse_rhs = rhs.is_sparse(n_nonzero);
+        ThreadPool::instance().parallel_for(SIZE, [&](std::size_t begin, std::size_t end) {
+            for(std::size_t row = begin; row < end; row++) {
+                const T& lhs = this->data[row];
+                Vector<T, RHS_SIZE>& out_row = out[row];
+                // zero rows (e.g. errors of inactive relu neurons) give a zero row in the outer product,
+                // as do the zero elements of rhs, even facing an infinite or NaN element (IEEE giving NaN for 0 * inf)
+                if(lhs == T()) {
+                    out_row = Vector<T, RHS_SIZE>(T());
+                } else if(sparse_rhs) {
+                    out_row = Vector<T, RHS_SIZE>(T());
+                    for(std::size_t i = 0; i < n_nonzero; i++) {
+                        std::size_t col = indices[i];
+                        out_row[col] = lhs * rhs[col];
+                    }
+                } else {
+                    for(std::size_t col = 0; col < RHS_SIZE; col++) {
+                        out_row[col] = lhs * rhs[col];
+                    }
+                }
             }
-        }
+        }, ThreadPool::grain_for(RHS_SIZE));
         return out;
     }
 
-    Vector<T, SIZE> softmax() const {
-        T total = T();
-        for (std::size_t i = 0; i < SIZE; i++) {
-            total += std::exp(this->data[i]);
+    // Per thread buffer of SIZE indices for nonzero_indices, reused by every call rather than taking
+    // SIZE * sizeof(std::size_t) bytes (6 KB for an image) from the stack of the pool threads.
+    static std::size_t* index_buffer() {
+        static thread_local std::vector<std::size_t> buffer(SIZE);
+        return buffer.data();
+    }
+
+    // Fill indices with the positions of the non zero elements, returns how many were found.
+    std::size_t nonzero_indices(std::size_t* indices) const {
+        std::size_t count = 0;
+        for(std::size_t i = 0; i < SIZE; i++) {
+            if(this->data[i] != T()) {
+                indices[count++] = i;
+            }
         }
+        return count;
+    }
+
+    bool is_sparse(std::size_t n_nonzero) const {
+        return n_nonzero < SIZE * SPARSE_DENSITY_THRESHOLD;
+    }
+
+    // The max is subtracted before exponentiating so large logits can't overflow.
+    // fast_exp clamping its input to -87, a logit more than 87 below the max gets exp(-87) / total
+    // (at least 1.6e-38 / SIZE) rather than 0 or a denormal, so no probability is ever exactly 0.
+    Vector<T, SIZE> softmax() const {
         Vector<T, SIZE> out;
-		for (std::size_t i = 0; i < SIZE; i++) {
-            out[i] = std::exp(this->data[i]) / total;
+        T total = out.exp_shifted(*this, this->max());
+        T inv_total = 1 / total;
+        for (std::size_t i = 0; i < SIZE; i++) {
+            out.data[i] *= inv_total;
         }
         return out;
     }
 
+    // Fused softmax and cross-entropy on logits, expected being a probability distribution (e.g. one-hot).
+    // Stores expected - softmax(logits), the descent direction of the loss w.r.t. the logits, in errors
+    // and returns the loss, computed through log-sum-exp to stay finite (and exact for the logits far
+    // below the max, unlike the softmax probabilities floored by the clamp of fast_exp).
+    T softmax_cross_entropy(const Vector<T, SIZE>& expected, Vector<T, SIZE>& errors) const {
+        T max_elem = this->max();
+        T total = errors.exp_shifted(*this, max_elem);
+        T inv_total = 1 / total;
+        T log_total = std::log(total);
+        T loss = T();
+        for (std::size_t i = 0; i < SIZE; i++) {
+            loss -= expected.data[i] * (this->data[i] - max_elem - log_total);
+            errors.data[i] = expected.data[i] - errors.data[i] * inv_total;
+        }
+        return loss;
+    }
+
+    T max() const {
+        if(SIZE == 0) {
+            throw std::runtime_error("The max method is not possible on a vector of size 0.");
+        }
+        T max_elem = this->data[0];
+        for(std::size_t i = 1; i < SIZE; i++) {
+            max_elem = this->data[i] > max_elem ? this->data[i] : max_elem;
+        }
+        return max_elem;
+    }
+
     std::size_t argmax() const {
         if(SIZE == 0) {
             throw std::runtime_error("The argmax method is not possible on a vector of size 0.");
@@ -118,6 +196,14 @@ public:
 
 
 
+    T* raw_data() {
+        return this->data;
+    }
+
+    const T* raw_data() const {
+        return this->data;
+    }
+
     T& operator[](size_t i) {
         if(i >= SIZE) {
 			throw std::out_of_range(string_format("Tried to access index %lu but the vector has %lu elements.", i, SIZE));
@@ -267,5 +353,30 @@ public:
 
 
 private:
+    // Fill this with exp(input - shift) and return the sum of the elements.
+    T exp_shifted(const Vector<T, SIZE>& input, const T& shift) {
+        // separate loops, the in order float sum would keep the exp pass from vectorizing
+        for (std::size_t i = 0; i < SIZE; i++) {
+            this->data[i] = fast_exp(input.data[i] - shift);
+        }
+        T total = T();
+        for (std::size_t i = 0; i < SIZE; i++) {
+            total += this->data[i];
+        }
+        return total;
+    }
+
     T data[SIZE];
-};
\ No newline at end of file
+};
+// A Vector is a single row of a parallel_reduce partial result.
+template<typename T, std::size_t SIZE>
+std::size_t partial_rows(const Vector<T, SIZE>&) {
+    return 1;
+}
+
+template<typename T, std::size_t SIZE>
+void add_partial_rows(Vector<T, SIZE>& out, const Vector<T, SIZE>& in, std::size_t begin, std::size_t end) {
+    if(begin == 0 && end > 0) {
+        out += in;
+    }
+}
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <tuple>
+
+#include "../matrix/matrix.hpp"
+#include "../util/img.hpp"
+#include "../util/thread_pool.hpp"
+#include "conv2d.hpp"
+#include "pooling.hpp"
+
+// Number of images going through the convolution at once, the im2col matrix growing with it.
+#define CONV_BATCH_SIZE 10
+
+// Small convolutional network for the Img images:
+// convolution (FILTERS filters of KERNEL_SIZE x KERNEL_SIZE) -> activation -> max pooling -> dense output layer,
+// trained with the softmax cross-entropy loss like NeuralNetwork.
+template<typename T, std::size_t FILTERS, std::size_t KERNEL_SIZE, std::size_t POOL_SIZE, std::size_t OUTPUT_SIZE>
+class ConvNeuralNetwork {
+	typedef Conv2D<T, 1, IMAGE_HEIGHT, IMAGE_WIDTH, FILTERS, KERNEL_SIZE, CONV_BATCH_SIZE> ConvLayer;
+	typedef MaxPool2D<T, FILTERS, ConvLayer::OUTPUT_HEIGHT, ConvLayer::OUTPUT_WIDTH, POOL_SIZE, CONV_BATCH_SIZE> PoolLayer;
+	static constexpr std::size_t FLAT_SIZE = PoolLayer::OUTPUT_SIZE;
+
+public:
+	ConvNeuralNetwork() {
+		this->output_weights.randomize(FLAT_SIZE);
+	}
+
+	ConvNeuralNetwork(std::ifstream& in): conv(in), output_weights(in) { }
+
+	// Returns the summed weight deltas and the summed loss of the mini batch,
+	// its batches of conv_batch_size images being split between the threads of the pool.
+	std::tuple<
+		typename ConvLayer::Weights,
+		Matrix<T, OUTPUT_SIZE, FLAT_SIZE>,
+		T
+	> train_mini_batch(
+		Img* imgs,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime,
+		std::size_t mini_batch_size
+	) const {
+		typedef std::tuple<typename ConvLayer::Weights, Matrix<T, OUTPUT_SIZE, FLAT_SIZE>, T> Deltas;
+		std::size_t batch_size = conv_batch_size(mini_batch_size);
+		std::size_t n_batches = (mini_batch_size + batch_size - 1) / batch_size;
+		return ThreadPool::instance().parallel_reduce<Deltas>(n_batches, [&](Deltas& deltas, std::size_t begin, std::size_t end) {
+			Workspace& ws = thread_workspace();
+			for(std::size_t i = begin * batch_size; i < std::min(end * batch_size, mini_batch_size); i += batch_size) {
+				std::size_t n_imgs = std::min(batch_size, mini_batch_size - i);
+				feed_forward(imgs + i, n_imgs, ws, activation);
+				std::get<2>(deltas) += back_propagate(imgs + i, n_imgs, ws, activation_prime);
+				std::get<0>(deltas) += ws.conv_delta;
+				std::get<1>(deltas) += ws.output_delta;
+			}
+		});
+	}
+
+	// Images convolved at once by train_mini_batch: CONV_BATCH_SIZE, or fewer when the mini batch would otherwise
+	// be too few batches to keep every thread of the pool busy, the dots of a batch running inline in its thread.
+	static std::size_t conv_batch_size(std::size_t mini_batch_size) {
+		std::size_t n_blocks = ThreadPool::instance().available_threads() * PARALLEL_BLOCKS_PER_THREAD;
+		std::size_t batch_size = (mini_batch_size + n_blocks - 1) / n_blocks;
+		return std::max((std::size_t)1, std::min(batch_size, (std::size_t)CONV_BATCH_SIZE));
+	}
+
+	// Returns the mean loss of the mini batch, computed before the weights update.
+	T train_batch_inner(
+		Img* imgs,
+		const T& lr,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime,
+		std::size_t mini_batch_size
+	) {
+		typename ConvLayer::Weights conv_delta_sum;
+		Matrix<T, OUTPUT_SIZE, FLAT_SIZE> output_delta_sum;
+		T loss_sum;
+
+		std::tie(conv_delta_sum, output_delta_sum, loss_sum) = train_mini_batch(imgs, activation, activation_prime, mini_batch_size);
+
+		this->conv.update(conv_delta_sum, lr / mini_batch_size);
+		this->output_weights += output_delta_sum * (lr / mini_batch_size);
+
+		return loss_sum / mini_batch_size;
+	}
+
+	void train_batch(
+		Img* imgs,
+		std::size_t epochs,
+		std::size_t batch_size,
+		std::size_t mini_batch_size,
+		T lr,
+		const T& lr_coef,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime
+	) {
+		for(std::size_t e = 1; e <= epochs; e++) {
+			for (std::size_t i = 0; i < batch_size; i += mini_batch_size) {
+				T loss = train_batch_inner(imgs + i, lr, activation, activation_prime, mini_batch_size);
+				std::cout << "Epoch " << e << '/' << epochs << ", Img Batch No. " << (i / mini_batch_size) + 1 << '/' << batch_size / mini_batch_size << ", Loss: " << loss << std::endl;
+			}
+			lr *= lr_coef;
+		}
+	}
+
+	Vector<T, OUTPUT_SIZE> predict(const Img& img, std::function<T(const T&)>& activation) const {
+		Workspace& ws = thread_workspace();
+		feed_forward(&img, 1, ws, activation);
+		return ws.logits[0].softmax();
+	}
+
+	std::size_t predict_img(const Img& img, std::function<T(const T&)>& activation) const {
+		return predict(img, activation).argmax();
+	}
+
+	double predict_imgs(Img* imgs, std::size_t n_imgs, std::function<T(const T&)>& activation) const {
+		std::size_t n_batches = (n_imgs + CONV_BATCH_SIZE - 1) / CONV_BATCH_SIZE;
+		std::size_t n_correct = ThreadPool::instance().parallel_reduce<std::size_t>(n_batches, [&](std::size_t& n_block_correct, std::size_t begin, std::size_t end) {
+			Workspace& ws = thread_workspace();
+			for(std::size_t i = begin * CONV_BATCH_SIZE; i < std::min(end * CONV_BATCH_SIZE, n_imgs); i += CONV_BATCH_SIZE) {
+				std::size_t n_batch = std::min((std::size_t)CONV_BATCH_SIZE, n_imgs - i);
+				feed_forward(imgs + i, n_batch, ws, activation);
+				for(std::size_t b = 0; b < n_batch; b++) {
+					if(ws.logits[b].argmax() == (std::size_t)imgs[i + b].label) {
+						n_block_correct++;
+					}
+				}
+			}
+		});
+		return 1.0 * n_correct / n_imgs;
+	}
+
+	std::ofstream& save_binary(std::ofstream& out) const {
+		this->conv.save_binary(out);
+		this->output_weights.save_binary(out);
+		return out;
+	}
+
+private:
+	// Intermediate values of a batch of up to CONV_BATCH_SIZE images, kept from the forward pass for the backward one.
+	// A batch of n_imgs images only writes and reads the columns of the convolution matrices of these images,
+	// the others holding stale values of a previous batch. The pooled rows and the output errors of the missing
+	// images are zeroed instead, the products of the output layer spanning the whole batch.
+	struct Workspace {
+		typename ConvLayer::Cols cols;
+		typename ConvLayer::Output conv_output;
+		typename PoolLayer::Output pooled;
+		typename PoolLayer::Indices pool_indices;
+		Matrix<T, CONV_BATCH_SIZE, OUTPUT_SIZE> logits;
+
+		Matrix<T, CONV_BATCH_SIZE, OUTPUT_SIZE> output_errors;
+		typename PoolLayer::Output pooled_errors;
+		typename ConvLayer::Output conv_errors;
+
+		typename ConvLayer::Weights conv_delta;
+		Matrix<T, OUTPUT_SIZE, FLAT_SIZE> output_delta;
+	};
+
+	// Workspace of the calling thread, allocated on its first use and then reused by every call
+	// (the intermediate matrices being too large for the stack and too large to allocate per image).
+	static Workspace& thread_workspace() {
+		static thread_local std::unique_ptr<Workspace> ws;
+		if(!ws) {
+			ws.reset(new Workspace());
+		}
+		return *ws;
+	}
+
+	void feed_forward(const Img* imgs, std::size_t n_imgs, Workspace& ws, std::function<T(const T&)>& activation) const {
+		const T* inputs[CONV_BATCH_SIZE];
+		for(std::size_t b = 0; b < n_imgs; b++) {
+			inputs[b] = imgs[b].img_data.raw_data();
+		}
+		ConvLayer::im2col(inputs, n_imgs, ws.cols);
+		this->conv.forward(ws.cols, n_imgs, ws.conv_output);
+		T* conv_data = ws.conv_output.raw_data();
+		for(std::size_t filter = 0; filter < FILTERS; filter++) {
+			T* row = conv_data + filter * CONV_BATCH_SIZE * ConvLayer::OUTPUT_PIXELS;
+			for(std::size_t i = 0; i < n_imgs * ConvLayer::OUTPUT_PIXELS; i++) {
+				row[i] = activation(row[i]);
+			}
+		}
+		PoolLayer::forward(ws.conv_output, n_imgs, ws.pooled, ws.pool_indices);
+		ws.pooled.dot_transposed(this->output_weights, ws.logits);
+	}
+
+	// Fill the weight deltas of the workspace, returns the summed loss of the batch.
+	T back_propagate(const Img* imgs, std::size_t n_imgs, Workspace& ws, std::function<T(const T&)>& activation_prime) const {
+		T loss_sum = T();
+		for(std::size_t b = 0; b < CONV_BATCH_SIZE; b++) {
+			if(b < n_imgs) {
+				Vector<T, OUTPUT_SIZE> expected_output(0);
+				expected_output[imgs[b].label] = 1;
+				loss_sum += ws.logits[b].softmax_cross_entropy(expected_output, ws.output_errors[b]);
+			} else {
+				// the missing images must not contribute to the output layer delta
+				ws.output_errors[b] = Vector<T, OUTPUT_SIZE>(0);
+			}
+		}
+
+		Matrix<T, OUTPUT_SIZE, CONV_BATCH_SIZE> transposed_errors = ws.output_errors.transpose();
+		transposed_errors.dot(ws.pooled, ws.output_delta);
+		ws.output_errors.dot(this->output_weights, ws.pooled_errors);
+
+		PoolLayer::backward(ws.pooled_errors, ws.pool_indices, n_imgs, ws.conv_errors);
+		for(std::size_t filter = 0; filter < FILTERS; filter++) {
+			T* errors_row = ws.conv_errors.raw_data() + filter * CONV_BATCH_SIZE * ConvLayer::OUTPUT_PIXELS;
+			const T* output_row = ws.conv_output.raw_data() + filter * CONV_BATCH_SIZE * ConvLayer::OUTPUT_PIXELS;
+			for(std::size_t i = 0; i < n_imgs * ConvLayer::OUTPUT_PIXELS; i++) {
+				if(errors_row[i] != T()) {
+					errors_row[i] *= activation_prime(output_row[i]);
+				}
+			}
+		}
+		ConvLayer::backward(ws.conv_errors, ws.cols, n_imgs, ws.conv_delta);
+		return loss_sum;
+	}
+
+	ConvLayer conv;
+	Matrix<T, OUTPUT_SIZE, FLAT_SIZE> output_weights;
+};
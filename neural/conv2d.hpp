@@ -0,0 +1,86 @@
+#pragma once
+
+#include "../matrix/matrix.hpp"
+
+// 2D convolution layer (stride 1, no padding) lowered to a matrix product through im2col,
+// processing up to BATCH inputs of CHANNELS x HEIGHT x WIDTH contiguous elements at once.
+// Its output has one row per filter and one column per output pixel of every input:
+// column b * OUTPUT_PIXELS + y * OUTPUT_WIDTH + x for the pixel (y, x) of input b.
+template<typename T, std::size_t CHANNELS, std::size_t HEIGHT, std::size_t WIDTH, std::size_t FILTERS, std::size_t KERNEL_SIZE, std::size_t BATCH>
+class Conv2D {
+public:
+	static constexpr std::size_t OUTPUT_HEIGHT = HEIGHT - KERNEL_SIZE + 1;
+	static constexpr std::size_t OUTPUT_WIDTH = WIDTH - KERNEL_SIZE + 1;
+	static constexpr std::size_t OUTPUT_PIXELS = OUTPUT_HEIGHT * OUTPUT_WIDTH;
+	static constexpr std::size_t PATCH_SIZE = CHANNELS * KERNEL_SIZE * KERNEL_SIZE;
+
+	typedef Matrix<T, PATCH_SIZE, BATCH * OUTPUT_PIXELS> Cols;
+	typedef Matrix<T, FILTERS, BATCH * OUTPUT_PIXELS> Output;
+	typedef Matrix<T, FILTERS, PATCH_SIZE> Weights;
+
+	Conv2D() {
+		this->weights.randomize(PATCH_SIZE);
+	}
+
+	Conv2D(std::ifstream& in): weights(in) { }
+
+	// Unfold the n_inputs (<= BATCH) inputs in cols, row (c * KERNEL_SIZE + ky) * KERNEL_SIZE + kx
+	// holding the input pixel (c, y + ky, x + kx) for every output pixel (y, x).
+	// The columns of the other inputs are left untouched, forward and backward only reading the first n_inputs.
+	static void im2col(const T* const* inputs, std::size_t n_inputs, Cols& cols) {
+		check_batch(n_inputs);
+		T* cols_data = cols.raw_data();
+		for(std::size_t c = 0; c < CHANNELS; c++) {
+			for(std::size_t ky = 0; ky < KERNEL_SIZE; ky++) {
+				for(std::size_t kx = 0; kx < KERNEL_SIZE; kx++) {
+					T* row = cols_data + ((c * KERNEL_SIZE + ky) * KERNEL_SIZE + kx) * BATCH * OUTPUT_PIXELS;
+					for(std::size_t b = 0; b < n_inputs; b++) {
+						const T* channel = inputs[b] + c * HEIGHT * WIDTH;
+						for(std::size_t y = 0; y < OUTPUT_HEIGHT; y++) {
+							const T* src = channel + (y + ky) * WIDTH + kx;
+							T* dst = row + b * OUTPUT_PIXELS + y * OUTPUT_WIDTH;
+							for(std::size_t x = 0; x < OUTPUT_WIDTH; x++) {
+								dst[x] = src[x];
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Output of the n_inputs first inputs unfolded in cols, the other columns of out being left untouched.
+	void forward(const Cols& cols, std::size_t n_inputs, Output& out) const {
+		check_batch(n_inputs);
+		this->weights.dot(cols, out, n_inputs * OUTPUT_PIXELS);
+	}
+
+	// Weights delta from the errors of the n_inputs first outputs and the cols they were computed from,
+	// the columns of the other inputs never being read.
+	// No errors are propagated to the inputs, the layer being meant as the first one of a network.
+	static void backward(const Output& output_errors, const Cols& cols, std::size_t n_inputs, Weights& delta) {
+		check_batch(n_inputs);
+		output_errors.dot_transposed(cols, delta, n_inputs * OUTPUT_PIXELS);
+	}
+
+	void update(const Weights& delta, const T& scale) {
+		this->weights += delta * scale;
+	}
+
+	const Weights& get_weights() const {
+		return this->weights;
+	}
+
+	std::ofstream& save_binary(std::ofstream& out) const {
+		return this->weights.save_binary(out);
+	}
+
+private:
+	static void check_batch(std::size_t n_inputs) {
+		if(n_inputs > BATCH) {
+			throw std::invalid_argument(string_format("Tried to convolve %lu inputs at once but the layer batch is %lu inputs", n_inputs, BATCH));
+		}
+	}
+
+	Weights weights;
+};
@@ -1,24 +1,44 @@
 #pragma once
 
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <tuple>
+#include <vector>
 
 #include "../matrix/matrix.hpp"
+#include "../util/augment.hpp"
 #include "../util/img.hpp"
+#include "../util/thread_pool.hpp"
+#include "../util/transport.hpp"
+#include "validation.hpp"
+
+// Chunks of rows of the hidden layer gradient all-reduced one at a time by train_batch_inner_distributed.
+#define DISTRIBUTED_REDUCE_CHUNKS 4
 
 template<typename T, std::size_t INPUT_SIZE, std::size_t HIDDEN_SIZE, std::size_t OUTPUT_SIZE>
 class NeuralNetwork {
 public:
 	NeuralNetwork() {
+		ThreadPool::instance().first_touch(this->hidden_weights.raw_data(), sizeof(T) * HIDDEN_SIZE * INPUT_SIZE);
 		this->hidden_weights.randomize(HIDDEN_SIZE);
 		this->output_weights.randomize(OUTPUT_SIZE);
 	}
 
+	// Weights saved by networks whose output layer was still activated load fine but compute other
+	// outputs, the output layer now being linear (see the README).
 	NeuralNetwork(std::ifstream& in): hidden_weights(in), output_weights(in) { }
 
+	// The output layer is trained with a softmax cross-entropy loss on its logits,
+	// returns the weight deltas and the loss of this input.
 	std::tuple<
 		Matrix<T, HIDDEN_SIZE, INPUT_SIZE>,
-		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>
+		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>,
+		T
 	> train(
 		const Vector<T, INPUT_SIZE>& input,
 		const Vector<T, OUTPUT_SIZE>& expected_output,
@@ -30,52 +50,102 @@ public:
 		std::tie(hidden_output, final_output) = feed_forward(input, activation);
 		Vector<T, HIDDEN_SIZE> hidden_errors;
 		Vector<T, OUTPUT_SIZE> output_errors;
-		std::tie(hidden_errors, output_errors) = find_errors(expected_output, final_output);
-		return back_propagate(hidden_errors, output_errors, hidden_output, final_output, input, activation_prime);
+		T loss;
+		std::tie(hidden_errors, output_errors, loss) = find_errors(expected_output, final_output);
+		// tuple_cat rather than unpacking in locals, these matrices weighing on the stack of the pool threads
+		return std::tuple_cat(back_propagate(hidden_errors, output_errors, hidden_output, input, activation_prime), std::make_tuple(loss));
 	}
 
+	// Returns the summed weight deltas and the summed loss of the mini batch,
+	// the images being split between the threads of the pool.
 	std::tuple<
 		Matrix<T, HIDDEN_SIZE, INPUT_SIZE>,
-		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>
+		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>,
+		T
 	> train_mini_batch(
 		Img* imgs,
 		std::function<T(const T&)>& activation,
 		std::function<T(const T&)>& activation_prime,
 		std::size_t mini_batch_size
 	) const {
-		Matrix<T, HIDDEN_SIZE, INPUT_SIZE> hidden_delta_avg(0);
-		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE> output_delta_avg(0);
-		for(size_t i = 0; i < mini_batch_size; i++) {
-			Img* cur_img = imgs + i;
-			Vector<T, OUTPUT_SIZE> expected_output(0);
-			expected_output[cur_img->label] = 1;
-
-			Matrix<T, HIDDEN_SIZE, INPUT_SIZE> hidden_delta;
-			Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE> output_delta;
+		typedef std::tuple<Matrix<T, HIDDEN_SIZE, INPUT_SIZE>, Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>, T> Deltas;
+		return ThreadPool::instance().parallel_reduce<Deltas>(mini_batch_size, [&](Deltas& deltas, std::size_t begin, std::size_t end) {
+			for(size_t i = begin; i < end; i++) {
+				Img* cur_img = imgs + i;
+				Vector<T, OUTPUT_SIZE> expected_output(0);
+				expected_output[cur_img->label] = 1;
 
-			std::tie(hidden_delta, output_delta) = train(cur_img->img_data, expected_output, activation, activation_prime);
+				Deltas img_deltas = train(cur_img->img_data, expected_output, activation, activation_prime);
 
-			hidden_delta_avg += hidden_delta;
-			output_delta_avg += output_delta;
-		}
-
-		return std::make_tuple(hidden_delta_avg, output_delta_avg);
+				std::get<0>(deltas) += std::get<0>(img_deltas);
+				std::get<1>(deltas) += std::get<1>(img_deltas);
+				std::get<2>(deltas) += std::get<2>(img_deltas);
+			}
+		});
 	}
 
-	void train_batch_inner(
+	// Returns the mean loss of the mini batch, computed before the weights update.
+	T train_batch_inner(
 		Img* imgs, 
 		const T& lr,
 		std::function<T(const T&)>& activation,
 		std::function<T(const T&)>& activation_prime,
 		std::size_t mini_batch_size
 	) {
-		Matrix<T, HIDDEN_SIZE, INPUT_SIZE> hidden_delta_avg;
-		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE> output_delta_avg;
+		auto deltas = train_mini_batch(imgs, activation, activation_prime, mini_batch_size);
+		T loss_sum = std::get<2>(deltas);
+
+		this->hidden_weights += std::get<0>(deltas) * (lr / mini_batch_size);
+		this->output_weights += std::get<1>(deltas) * (lr / mini_batch_size);
+
+		if(this->masks) {
+			this->hidden_weights.apply_mask(this->masks->hidden);
+			this->output_weights.apply_mask(this->masks->output);
+		}
+
+		return loss_sum / mini_batch_size;
+	}
+
+	// Magnitude based pruning, zero the given ratio of the smallest weights,
+	// either ranked across both layers (global) or layer by layer.
+	// Pruned weights are kept at zero by the following calls to train_batch, allowing fine-tuning.
+	void prune(double sparsity, bool global = true) {
+		if(sparsity < 0.0 || sparsity >= 1.0) {
+			throw std::invalid_argument(string_format("Pruning sparsity must be in [0, 1), got %f", sparsity));
+		}
+		if(global) {
+			std::vector<T> magnitudes;
+			this->hidden_weights.magnitudes(magnitudes);
+			this->output_weights.magnitudes(magnitudes);
+			T threshold = magnitude_threshold(magnitudes, sparsity);
+			this->hidden_weights.prune(threshold);
+			this->output_weights.prune(threshold);
+		} else {
+			std::vector<T> hidden_magnitudes;
+			this->hidden_weights.magnitudes(hidden_magnitudes);
+			this->hidden_weights.prune(magnitude_threshold(hidden_magnitudes, sparsity));
+			std::vector<T> output_magnitudes;
+			this->output_weights.magnitudes(output_magnitudes);
+			this->output_weights.prune(magnitude_threshold(output_magnitudes, sparsity));
+		}
+		std::shared_ptr<PruningMasks> masks(new PruningMasks());
+		masks->hidden = this->hidden_weights.nonzero_mask();
+		masks->output = this->output_weights.nonzero_mask();
+		this->masks = masks;
+	}
 
-		std::tie(hidden_delta_avg, output_delta_avg) = train_mini_batch(imgs, activation, activation_prime, mini_batch_size);
+	double sparsity() const {
+		std::size_t n_weights = HIDDEN_SIZE * INPUT_SIZE + OUTPUT_SIZE * HIDDEN_SIZE;
+		std::size_t n_nonzero = this->hidden_weights.count_nonzero() + this->output_weights.count_nonzero();
+		return 1.0 - 1.0 * n_nonzero / n_weights;
+	}
+
+	const Matrix<T, HIDDEN_SIZE, INPUT_SIZE>& get_hidden_weights() const {
+		return this->hidden_weights;
+	}
 
-		this->hidden_weights += hidden_delta_avg * (lr / mini_batch_size);
-		this->output_weights += output_delta_avg * (lr / mini_batch_size);
+	const Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>& get_output_weights() const {
+		return this->output_weights;
 	}
 
 	void train_batch(
@@ -90,8 +160,251 @@ public:
 	) {
 		for(std::size_t e = 1; e <= epochs; e++) {
 			for (std::size_t i = 0; i < batch_size; i += mini_batch_size) {
-				std::cout << "Epoch " << e << '/' << epochs << ", Img Batch No. " << (i / mini_batch_size) + 1 << '/' << batch_size / mini_batch_size << std::endl;
-				train_batch_inner(imgs + i, lr, activation, activation_prime, mini_batch_size);
+				T loss = train_batch_inner(imgs + i, lr, activation, activation_prime, mini_batch_size);
+				std::cout << "Epoch " << e << '/' << epochs << ", Img Batch No. " << (i / mini_batch_size) + 1 << '/' << batch_size / mini_batch_size << ", Loss: " << loss << std::endl;
+			}
+			lr *= lr_coef;
+		}
+	}
+
+	// train_batch validating a snapshot of the weights on validation_imgs every validation_interval mini batches,
+	// on a background thread so the training never waits for it (a checkpoint is skipped if the previous
+	// validation is still running). Training stops early once the validation loss hasn't improved for
+	// patience validations, and the weights with the lowest validation loss are restored at the end
+	// (the last ones are kept if no validation loss was finite).
+	void train_batch_validated(
+		Img* imgs,
+		std::size_t epochs,
+		std::size_t batch_size,
+		std::size_t mini_batch_size,
+		T lr,
+		const T& lr_coef,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime,
+		Img* validation_imgs,
+		std::size_t n_validation_imgs,
+		std::size_t validation_interval,
+		std::size_t patience
+	) {
+		if(n_validation_imgs == 0) {
+			throw std::invalid_argument("Validated training needs at least one validation image");
+		}
+		if(validation_interval == 0) {
+			throw std::invalid_argument("Validated training needs a validation interval of at least one mini batch");
+		}
+		BackgroundValidator<NeuralNetwork, T> validator(*this, validation_imgs, n_validation_imgs, patience, activation);
+		std::size_t n_mini_batches = 0;
+		std::size_t e = 1, i = 0;
+		for(; e <= epochs && !validator.should_stop(); e++) {
+			for (i = 0; i < batch_size && !validator.should_stop(); i += mini_batch_size) {
+				T loss = train_batch_inner(imgs + i, lr, activation, activation_prime, mini_batch_size);
+				std::cout << "Epoch " << e << '/' << epochs << ", Img Batch No. " << (i / mini_batch_size) + 1 << '/' << batch_size / mini_batch_size << ", Loss: " << loss << std::endl;
+				if(++n_mini_batches % validation_interval == 0) {
+					validator.try_validate(*this, e, (i / mini_batch_size) + 1);
+				}
+			}
+			lr *= lr_coef;
+		}
+		// the last weights are always validated
+		if(!validator.should_stop()) {
+			validator.validate_now(*this, e - 1, i / mini_batch_size);
+		}
+		validator.wait();
+		if(validator.has_best()) {
+			*this = validator.best();
+		}
+	}
+
+	// train_batch on augmented copies of the images, a new random augmentation per epoch.
+	// The mini batches are augmented by n_workers background threads while the previous ones train.
+	void train_batch_augmented(
+		Img* imgs,
+		std::size_t epochs,
+		std::size_t batch_size,
+		std::size_t mini_batch_size,
+		T lr,
+		const T& lr_coef,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime,
+		const AugmentParams& params,
+		std::size_t n_workers = 1
+	) {
+		AugmentPipeline pipeline(imgs, batch_size, mini_batch_size, epochs, params, n_workers);
+		for(std::size_t e = 1; e <= epochs; e++) {
+			for (std::size_t i = 0; i < batch_size / mini_batch_size; i++) {
+				T loss = train_batch_inner(pipeline.next_batch(), lr, activation, activation_prime, mini_batch_size);
+				std::cout << "Epoch " << e << '/' << epochs << ", Img Batch No. " << i + 1 << '/' << batch_size / mini_batch_size << ", Loss: " << loss << std::endl;
+			}
+			lr *= lr_coef;
+		}
+	}
+
+	// Asynchronous counterpart of train_batch (Hogwild), the threads of the pool training on their own
+	// mini batches and applying their updates straight to the shared weights without any lock.
+	// The mini batches of an epoch are split by parallel_reduce in runs of consecutive mini batches,
+	// several per thread, queued to the threads of the pool, a thread done with its own runs stealing
+	// the ones still queued to the others.
+	// Semantics: updates go through Matrix::add_scaled_relaxed so no weight is ever torn, but a thread
+	// computes its gradient on weights other threads are updating, and two simultaneous updates of a
+	// weight may lose one of them. Zero gradients (inactive relu neurons, zero pixels) are skipped,
+	// keeping these collisions rare.
+	void train_batch_hogwild(
+		Img* imgs,
+		std::size_t epochs,
+		std::size_t batch_size,
+		std::size_t mini_batch_size,
+		T lr,
+		const T& lr_coef,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime
+	) {
+		std::size_t n_mini_batches = batch_size / mini_batch_size;
+		for(std::size_t e = 1; e <= epochs; e++) {
+			T loss_sum = ThreadPool::instance().parallel_reduce<T>(n_mini_batches, [&](T& block_loss_sum, std::size_t begin, std::size_t end) {
+				block_loss_sum += hogwild_mini_batches(imgs, begin, end, lr, activation, activation_prime, mini_batch_size);
+			});
+			std::cout << "Epoch " << e << '/' << epochs << ", Loss: " << loss_sum / (n_mini_batches * mini_batch_size) << std::endl;
+			lr *= lr_coef;
+		}
+	}
+
+	// Data parallel counterpart of train_batch_inner, every rank training on its own mini batch
+	// and the gradients being summed across ranks with ring all-reduces run by another thread,
+	// overlapping the compute: first the output layer gradient and the loss while the hidden layer
+	// gradient is computed, then that gradient in DISTRIBUTED_REDUCE_CHUNKS chunks of rows, every chunk
+	// being all-reduced while the next ones are computed.
+	// Returns the mean loss across every rank.
+	T train_batch_inner_distributed(
+		Transport& transport,
+		Img* imgs,
+		const T& lr,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime,
+		std::size_t mini_batch_size
+	) {
+		// errors of the hidden neurons times the derivative of their activation, per image
+		std::vector<Vector<T, HIDDEN_SIZE>> hidden_gradients(mini_batch_size);
+		typedef std::tuple<Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>, T> OutputDeltas;
+		OutputDeltas output_deltas = ThreadPool::instance().parallel_reduce<OutputDeltas>(mini_batch_size, [&](OutputDeltas& deltas, std::size_t begin, std::size_t end) {
+			for(size_t i = begin; i < end; i++) {
+				Img* cur_img = imgs + i;
+				Vector<T, OUTPUT_SIZE> expected_output(0);
+				expected_output[cur_img->label] = 1;
+
+				Vector<T, HIDDEN_SIZE> hidden_output;
+				Vector<T, OUTPUT_SIZE> final_output;
+				std::tie(hidden_output, final_output) = feed_forward(cur_img->img_data, activation);
+				Vector<T, HIDDEN_SIZE> hidden_errors;
+				Vector<T, OUTPUT_SIZE> output_errors;
+				T loss;
+				std::tie(hidden_errors, output_errors, loss) = find_errors(expected_output, final_output);
+				hidden_gradients[i] = hidden_errors * hidden_output.apply(activation_prime);
+				std::get<0>(deltas) += output_errors.dot(hidden_output);
+				std::get<1>(deltas) += loss;
+			}
+		});
+		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE>& output_delta_sum = std::get<0>(output_deltas);
+		T& loss_sum = std::get<1>(output_deltas);
+
+		Matrix<T, HIDDEN_SIZE, INPUT_SIZE> hidden_delta_sum;
+		std::mutex chunks_mutex;
+		std::condition_variable chunks_cv;
+		std::size_t n_ready_chunks = 0;
+		std::exception_ptr reduce_error;
+		std::thread reduce([&]() {
+			try {
+				ring_all_reduce(transport, output_delta_sum.raw_data(), OUTPUT_SIZE * HIDDEN_SIZE);
+				ring_all_reduce(transport, &loss_sum, 1);
+				for(std::size_t chunk = 0; chunk < DISTRIBUTED_REDUCE_CHUNKS; chunk++) {
+					{
+						std::unique_lock<std::mutex> lock(chunks_mutex);
+						chunks_cv.wait(lock, [&]() { return n_ready_chunks > chunk; });
+					}
+					std::size_t row_begin = HIDDEN_SIZE * chunk / DISTRIBUTED_REDUCE_CHUNKS;
+					std::size_t row_end = HIDDEN_SIZE * (chunk + 1) / DISTRIBUTED_REDUCE_CHUNKS;
+					ring_all_reduce(transport, hidden_delta_sum.raw_data() + row_begin * INPUT_SIZE, (row_end - row_begin) * INPUT_SIZE);
+				}
+			} catch(...) {
+				reduce_error = std::current_exception();
+			}
+		});
+
+		// summed over the images row by row, in the same order on every thread, rather than through per thread partials
+		for(std::size_t chunk = 0; chunk < DISTRIBUTED_REDUCE_CHUNKS; chunk++) {
+			std::size_t row_begin = HIDDEN_SIZE * chunk / DISTRIBUTED_REDUCE_CHUNKS;
+			std::size_t row_end = HIDDEN_SIZE * (chunk + 1) / DISTRIBUTED_REDUCE_CHUNKS;
+			ThreadPool::instance().parallel_for(row_end - row_begin, [&](std::size_t begin, std::size_t end) {
+				for(std::size_t row = row_begin + begin; row < row_begin + end; row++) {
+					T* delta_row = hidden_delta_sum.raw_data() + row * INPUT_SIZE;
+					std::fill(delta_row, delta_row + INPUT_SIZE, T());
+					for(std::size_t i = 0; i < mini_batch_size; i++) {
+						T gradient = hidden_gradients[i][row];
+						if(gradient == T()) {
+							continue;
+						}
+						const T* input = imgs[i].img_data.raw_data();
+						for(std::size_t col = 0; col < INPUT_SIZE; col++) {
+							delta_row[col] += gradient * input[col];
+						}
+					}
+				}
+			}, ThreadPool::grain_for(mini_batch_size * INPUT_SIZE));
+			{
+				std::lock_guard<std::mutex> lock(chunks_mutex);
+				n_ready_chunks = chunk + 1;
+			}
+			chunks_cv.notify_one();
+		}
+
+		reduce.join();
+		if(reduce_error) {
+			std::rethrow_exception(reduce_error);
+		}
+
+		std::size_t global_batch_size = mini_batch_size * transport.world_size();
+		this->hidden_weights += hidden_delta_sum * (lr / global_batch_size);
+		this->output_weights += output_delta_sum * (lr / global_batch_size);
+
+		if(this->masks) {
+			this->hidden_weights.apply_mask(this->masks->hidden);
+			this->output_weights.apply_mask(this->masks->output);
+		}
+
+		return loss_sum / global_batch_size;
+	}
+
+	// Data parallel counterpart of train_batch, meant to be called by every process of the transport ring.
+	// The batch_size images are split in one contiguous shard per rank, and the weights of rank 0 are
+	// broadcast first, every rank then applying the same all-reduced updates and staying bit identical.
+	// Every rank must train on the same number of full mini batches, so the batch_size % world_size last
+	// images and the shard_size % mini_batch_size last images of every shard are skipped (rank 0 logs how many).
+	void train_batch_distributed(
+		Transport& transport,
+		Img* imgs,
+		std::size_t epochs,
+		std::size_t batch_size,
+		std::size_t mini_batch_size,
+		T lr,
+		const T& lr_coef,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime
+	) {
+		ring_broadcast(transport, this->hidden_weights.raw_data(), HIDDEN_SIZE * INPUT_SIZE);
+		ring_broadcast(transport, this->output_weights.raw_data(), OUTPUT_SIZE * HIDDEN_SIZE);
+
+		std::size_t shard_size = batch_size / transport.world_size();
+		Img* shard = imgs + transport.rank() * shard_size;
+		std::size_t n_skipped = batch_size - (shard_size / mini_batch_size) * mini_batch_size * transport.world_size();
+		if(n_skipped != 0 && transport.rank() == 0) {
+			std::cout << "Distributed training skips " << n_skipped << '/' << batch_size << " images, the shards of "
+				<< shard_size << " images not being split in full mini batches of " << mini_batch_size << std::endl;
+		}
+		for(std::size_t e = 1; e <= epochs; e++) {
+			for (std::size_t i = 0; i + mini_batch_size <= shard_size; i += mini_batch_size) {
+				T loss = train_batch_inner_distributed(transport, shard + i, lr, activation, activation_prime, mini_batch_size);
+				if(transport.rank() == 0) {
+					std::cout << "Epoch " << e << '/' << epochs << ", Img Batch No. " << (i / mini_batch_size) + 1 << '/' << shard_size / mini_batch_size << ", Loss: " << loss << std::endl;
+				}
 			}
 			lr *= lr_coef;
 		}
@@ -109,17 +422,36 @@ public:
 	}
 
 	double predict_imgs(Img* imgs, std::size_t n_imgs, std::function<T(const T&)>& activation) const {
-		std::size_t n_correct = 0;
-		for(std::size_t i = 0; i < n_imgs; i++) {
-			Img& img = imgs[i];
-			std::size_t prediction = predict_img(img, activation);
-			if(prediction == img.label) {
-				n_correct++;
+		std::size_t n_correct = ThreadPool::instance().parallel_reduce<std::size_t>(n_imgs, [&](std::size_t& n_block_correct, std::size_t begin, std::size_t end) {
+			for(std::size_t i = begin; i < end; i++) {
+				Img& img = imgs[i];
+				std::size_t prediction = predict_img(img, activation);
+				if(prediction == img.label) {
+					n_block_correct++;
+				}
 			}
-		}
+		});
 		return 1.0 * n_correct / n_imgs;
 	}
 
+	// Mean cross-entropy loss and accuracy over imgs.
+	std::tuple<T, double> evaluate_imgs(Img* imgs, std::size_t n_imgs, std::function<T(const T&)>& activation) const {
+		auto res = ThreadPool::instance().parallel_reduce<std::tuple<T, std::size_t>>(n_imgs, [&](std::tuple<T, std::size_t>& block_res, std::size_t begin, std::size_t end) {
+			Vector<T, OUTPUT_SIZE> errors;
+			for(std::size_t i = begin; i < end; i++) {
+				Img& img = imgs[i];
+				Vector<T, OUTPUT_SIZE> final_output = std::get<1>(feed_forward(img.img_data, activation));
+				Vector<T, OUTPUT_SIZE> expected_output(0);
+				expected_output[img.label] = 1;
+				std::get<0>(block_res) += final_output.softmax_cross_entropy(expected_output, errors);
+				if(final_output.argmax() == img.label) {
+					std::get<1>(block_res)++;
+				}
+			}
+		});
+		return std::make_tuple(std::get<0>(res) / n_imgs, 1.0 * std::get<1>(res) / n_imgs);
+	}
+
 	std::ofstream& save_binary(std::ofstream& out) const {
 		this->hidden_weights.save_binary(out);
 		this->output_weights.save_binary(out);
@@ -135,19 +467,20 @@ private:
 	) const {
 		Vector<T, HIDDEN_SIZE> hidden_output_unactivated = this->hidden_weights.dot(input);
 		Vector<T, HIDDEN_SIZE> hidden_output = hidden_output_unactivated.apply(activation);
-		Vector<T, OUTPUT_SIZE> final_output_unactivated = this->output_weights.dot(hidden_output);
-		Vector<T, OUTPUT_SIZE> final_output = final_output_unactivated.apply(activation);
+		// the output layer stays linear, its logits going through the softmax
+		Vector<T, OUTPUT_SIZE> final_output = this->output_weights.dot(hidden_output);
 		return std::make_tuple(hidden_output, final_output);
 	}
 
-	std::tuple<Vector<T, HIDDEN_SIZE>, Vector<T, OUTPUT_SIZE>> find_errors(
+	std::tuple<Vector<T, HIDDEN_SIZE>, Vector<T, OUTPUT_SIZE>, T> find_errors(
 		const Vector<T, OUTPUT_SIZE>& expected_output, 
 		const Vector<T, OUTPUT_SIZE>& final_output
 	) const {
 		Matrix<T, HIDDEN_SIZE, OUTPUT_SIZE> transposed_mat = this->output_weights.transpose();
-		Vector<T, OUTPUT_SIZE> output_errors = expected_output - final_output;
+		Vector<T, OUTPUT_SIZE> output_errors;
+		T loss = final_output.softmax_cross_entropy(expected_output, output_errors);
 		Vector<T, HIDDEN_SIZE> hidden_errors = transposed_mat.dot(output_errors);
-		return std::make_tuple(hidden_errors, output_errors);
+		return std::make_tuple(hidden_errors, output_errors, loss);
 	}
 
 	template<std::size_t WEIGHTS_ROWS, std::size_t WEIGHTS_COLS> 
@@ -169,16 +502,11 @@ private:
 		const Vector<T, HIDDEN_SIZE>& hidden_errors, 
 		const Vector<T, OUTPUT_SIZE>& output_errors,
 		const Vector<T, HIDDEN_SIZE>& hidden_output, 
-		const Vector<T, OUTPUT_SIZE>& final_output,
 		const Vector<T, INPUT_SIZE>& input,
 		std::function<T(const T&)>& activation_prime
 	) {
-		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE> output_delta = back_propagate_core(
-			final_output, 
-			output_errors, 
-			hidden_output, 
-			activation_prime
-		);
+		// the softmax cross-entropy errors already are the logits gradient, no activation to derive
+		Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE> output_delta = output_errors.dot(hidden_output);
 		Matrix<T, HIDDEN_SIZE, INPUT_SIZE> hidden_delta = back_propagate_core(
 			hidden_output, 
 			hidden_errors, 
@@ -189,6 +517,47 @@ private:
 		return std::make_tuple(hidden_delta, output_delta);
 	}
 
+	// Train on the mini batches [begin, end) with lock free updates, returns the summed loss.
+	T hogwild_mini_batches(
+		Img* imgs,
+		std::size_t begin,
+		std::size_t end,
+		const T& lr,
+		std::function<T(const T&)>& activation,
+		std::function<T(const T&)>& activation_prime,
+		std::size_t mini_batch_size
+	) {
+		const Matrix<bool, HIDDEN_SIZE, INPUT_SIZE>* hidden_mask = this->masks ? &this->masks->hidden : nullptr;
+		const Matrix<bool, OUTPUT_SIZE, HIDDEN_SIZE>* output_mask = this->masks ? &this->masks->output : nullptr;
+		T loss_sum = T();
+		for(std::size_t i = begin; i < end; i++) {
+			auto deltas = train_mini_batch(imgs + i * mini_batch_size, activation, activation_prime, mini_batch_size);
+			this->hidden_weights.add_scaled_relaxed(std::get<0>(deltas), lr / mini_batch_size, hidden_mask);
+			this->output_weights.add_scaled_relaxed(std::get<1>(deltas), lr / mini_batch_size, output_mask);
+			loss_sum += std::get<2>(deltas);
+		}
+		return loss_sum;
+	}
+
+	// Smallest magnitude kept when pruning the given ratio of magnitudes, reorders magnitudes.
+	static T magnitude_threshold(std::vector<T>& magnitudes, double sparsity) {
+		std::size_t k = (std::size_t)(sparsity * magnitudes.size());
+		if(k == 0) {
+			return T();
+		}
+		std::nth_element(magnitudes.begin(), magnitudes.begin() + k, magnitudes.end());
+		return magnitudes[k];
+	}
+
 	Matrix<T, HIDDEN_SIZE, INPUT_SIZE> hidden_weights;
 	Matrix<T, OUTPUT_SIZE, HIDDEN_SIZE> output_weights;
+
+	// Weights left by prune, the others being kept at zero. Only allocated once pruned, and shared
+	// by the copies of the network (e.g. the validation snapshots), prune replacing them rather than
+	// updating them in place.
+	struct PruningMasks {
+		Matrix<bool, HIDDEN_SIZE, INPUT_SIZE> hidden;
+		Matrix<bool, OUTPUT_SIZE, HIDDEN_SIZE> output;
+	};
+	std::shared_ptr<const PruningMasks> masks;
 };
\ No newline at end of file
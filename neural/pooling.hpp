@@ -0,0 +1,69 @@
+#pragma once
+
+#include "../matrix/matrix.hpp"
+
+// Max pooling over non overlapping POOL_SIZE x POOL_SIZE windows of BATCH inputs laid out like the Conv2D output:
+// one row per channel, the HEIGHT x WIDTH pixels of input b starting at column b * HEIGHT * WIDTH.
+// Its output is flattened with one row per input, ready for a dense layer.
+template<typename T, std::size_t CHANNELS, std::size_t HEIGHT, std::size_t WIDTH, std::size_t POOL_SIZE, std::size_t BATCH>
+class MaxPool2D {
+public:
+	static constexpr std::size_t OUTPUT_HEIGHT = HEIGHT / POOL_SIZE;
+	static constexpr std::size_t OUTPUT_WIDTH = WIDTH / POOL_SIZE;
+	static constexpr std::size_t OUTPUT_SIZE = CHANNELS * OUTPUT_HEIGHT * OUTPUT_WIDTH;
+
+	typedef Matrix<T, CHANNELS, BATCH * HEIGHT * WIDTH> Input;
+	typedef Matrix<T, BATCH, OUTPUT_SIZE> Output;
+	// column of the input each output element was taken from, for the backward pass
+	typedef Matrix<std::size_t, BATCH, OUTPUT_SIZE> Indices;
+
+	// Pool the n_inputs first inputs, the rows of the other ones being zeroed so that the products
+	// of the next layer, over the whole batch, never read the stale values of a previous batch.
+	static void forward(const Input& input, std::size_t n_inputs, Output& out, Indices& indices) {
+		for(std::size_t b = n_inputs; b < BATCH; b++) {
+			out[b] = Vector<T, OUTPUT_SIZE>(0);
+		}
+		for(std::size_t b = 0; b < n_inputs; b++) {
+			Vector<T, OUTPUT_SIZE>& out_row = out[b];
+			Vector<std::size_t, OUTPUT_SIZE>& indices_row = indices[b];
+			for(std::size_t c = 0; c < CHANNELS; c++) {
+				const Vector<T, BATCH * HEIGHT * WIDTH>& channel = input[c];
+				for(std::size_t y = 0; y < OUTPUT_HEIGHT; y++) {
+					for(std::size_t x = 0; x < OUTPUT_WIDTH; x++) {
+						std::size_t max_index = b * HEIGHT * WIDTH + y * POOL_SIZE * WIDTH + x * POOL_SIZE;
+						for(std::size_t dy = 0; dy < POOL_SIZE; dy++) {
+							for(std::size_t dx = 0; dx < POOL_SIZE; dx++) {
+								std::size_t index = b * HEIGHT * WIDTH + (y * POOL_SIZE + dy) * WIDTH + x * POOL_SIZE + dx;
+								if(channel[index] > channel[max_index]) {
+									max_index = index;
+								}
+							}
+						}
+						std::size_t out_index = (c * OUTPUT_HEIGHT + y) * OUTPUT_WIDTH + x;
+						out_row[out_index] = channel[max_index];
+						indices_row[out_index] = max_index;
+					}
+				}
+			}
+		}
+	}
+
+	// Route the errors of every output element of the n_inputs first inputs back to the input element
+	// it was taken from, the columns of the other inputs being left untouched.
+	static void backward(const Output& output_errors, const Indices& indices, std::size_t n_inputs, Input& input_errors) {
+		T* input_data = input_errors.raw_data();
+		for(std::size_t c = 0; c < CHANNELS; c++) {
+			for(std::size_t i = 0; i < n_inputs * HEIGHT * WIDTH; i++) {
+				input_data[c * BATCH * HEIGHT * WIDTH + i] = T();
+			}
+		}
+		for(std::size_t b = 0; b < n_inputs; b++) {
+			for(std::size_t c = 0; c < CHANNELS; c++) {
+				Vector<T, BATCH * HEIGHT * WIDTH>& channel = input_errors[c];
+				for(std::size_t i = c * OUTPUT_HEIGHT * OUTPUT_WIDTH; i < (c + 1) * OUTPUT_HEIGHT * OUTPUT_WIDTH; i++) {
+					channel[indices[b][i]] += output_errors[b][i];
+				}
+			}
+		}
+	}
+};
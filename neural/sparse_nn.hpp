@@ -0,0 +1,66 @@
+#pragma once
+
+#include <functional>
+#include <tuple>
+
+#include "../matrix/sparse_matrix.hpp"
+#include "../util/img.hpp"
+#include "nn.hpp"
+
+// Inference only network storing the weights of a pruned NeuralNetwork in compressed sparse column format,
+// cutting the memory traffic of predict by the sparsity of the weights.
+template<typename T, std::size_t INPUT_SIZE, std::size_t HIDDEN_SIZE, std::size_t OUTPUT_SIZE>
+class SparseNeuralNetwork {
+public:
+	SparseNeuralNetwork(const NeuralNetwork<T, INPUT_SIZE, HIDDEN_SIZE, OUTPUT_SIZE>& net):
+		hidden_weights(net.get_hidden_weights()), output_weights(net.get_output_weights()) { }
+
+	SparseNeuralNetwork(std::ifstream& in): hidden_weights(in), output_weights(in) { }
+
+	Vector<T, OUTPUT_SIZE> predict(const Vector<T, INPUT_SIZE>& input, std::function<T(const T&)>& activation) const {
+		return feed_forward(input, activation).softmax();
+	}
+
+	std::size_t predict_img(const Img& img, std::function<T(const T&)>& activation) const {
+		Vector<T, OUTPUT_SIZE> res = predict(img.img_data, activation);
+		return res.argmax();
+	}
+
+	double predict_imgs(Img* imgs, std::size_t n_imgs, std::function<T(const T&)>& activation) const {
+		std::size_t n_correct = ThreadPool::instance().parallel_reduce<std::size_t>(n_imgs, [&](std::size_t& n_block_correct, std::size_t begin, std::size_t end) {
+			for(std::size_t i = begin; i < end; i++) {
+				Img& img = imgs[i];
+				std::size_t prediction = predict_img(img, activation);
+				if(prediction == img.label) {
+					n_block_correct++;
+				}
+			}
+		});
+		return 1.0 * n_correct / n_imgs;
+	}
+
+	double sparsity() const {
+		std::size_t n_weights = HIDDEN_SIZE * INPUT_SIZE + OUTPUT_SIZE * HIDDEN_SIZE;
+		std::size_t n_nonzero = this->hidden_weights.count_nonzero() + this->output_weights.count_nonzero();
+		return 1.0 - 1.0 * n_nonzero / n_weights;
+	}
+
+	std::ofstream& save_binary(std::ofstream& out) const {
+		this->hidden_weights.save_binary(out);
+		this->output_weights.save_binary(out);
+		return out;
+	}
+
+private:
+
+	Vector<T, OUTPUT_SIZE> feed_forward(
+		const Vector<T, INPUT_SIZE>& input,
+		std::function<T(const T&)>& activation
+	) const {
+		Vector<T, HIDDEN_SIZE> hidden_output = this->hidden_weights.dot(input).apply(activation);
+		return this->output_weights.dot(hidden_output);
+	}
+
+	SparseMatrix<T, HIDDEN_SIZE, INPUT_SIZE> hidden_weights;
+	SparseMatrix<T, OUTPUT_SIZE, HIDDEN_SIZE> output_weights;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <tuple>
+
+#include "../util/img.hpp"
+#include "../util/thread_pool.hpp"
+
+// Evaluates snapshots of a network on a held-out set on a background thread while the network keeps training,
+// retaining the snapshot with the lowest validation loss and asking to stop once it hasn't improved
+// for patience validations in a row.
+// Net must be copyable and provide evaluate_imgs(imgs, n_imgs, activation) returning (loss, accuracy).
+template<typename Net, typename T>
+class BackgroundValidator {
+public:
+	BackgroundValidator(
+		const Net& net,
+		Img* imgs,
+		std::size_t n_imgs,
+		std::size_t patience,
+		std::function<T(const T&)>& activation
+	): imgs(imgs), n_imgs(n_imgs), patience(patience), activation(activation),
+		snapshot(new Net(net)), best_net(new Net(net)) { }
+
+	~BackgroundValidator() {
+		this->wait();
+	}
+
+	BackgroundValidator(const BackgroundValidator&) = delete;
+	BackgroundValidator& operator=(const BackgroundValidator&) = delete;
+
+	// Start validating a copy of net unless the previous validation is still running,
+	// in which case the training goes on and this checkpoint is skipped.
+	bool try_validate(const Net& net, std::size_t epoch, std::size_t mini_batch) {
+		if(this->running.load(std::memory_order_acquire)) {
+			return false;
+		}
+		this->wait();
+		*this->snapshot = net;
+		this->running.store(true, std::memory_order_relaxed);
+		this->thread = std::thread([this, epoch, mini_batch]() {
+			ThreadPool::run_inline_in_this_thread();
+			this->validate(epoch, mini_batch);
+		});
+		return true;
+	}
+
+	// Validate net on the calling thread, once the running validation if any is done.
+	void validate_now(const Net& net, std::size_t epoch, std::size_t mini_batch) {
+		this->wait();
+		*this->snapshot = net;
+		this->validate(epoch, mini_batch);
+	}
+
+	void wait() {
+		if(this->thread.joinable()) {
+			this->thread.join();
+		}
+	}
+
+	bool should_stop() const {
+		return this->stop.load(std::memory_order_acquire);
+	}
+
+	bool has_best() const {
+		return this->best_loss < std::numeric_limits<T>::max();
+	}
+
+	// Only meaningful once wait() returned.
+	const Net& best() const {
+		return *this->best_net;
+	}
+
+private:
+	void validate(std::size_t epoch, std::size_t mini_batch) {
+		auto res = this->snapshot->evaluate_imgs(this->imgs, this->n_imgs, this->activation);
+		T loss = std::get<0>(res);
+		double accuracy = std::get<1>(res);
+		bool improved = loss < this->best_loss;
+		if(improved) {
+			this->best_loss = loss;
+			*this->best_net = *this->snapshot;
+			this->n_bad_validations = 0;
+		} else if(++this->n_bad_validations >= this->patience) {
+			this->stop.store(true, std::memory_order_release);
+		}
+		std::cout << string_format(
+			"Validation after Epoch %lu, Img Batch No. %lu, Loss: %f, Accuracy: %2.3f%%%s\n",
+			epoch, mini_batch, (double)loss, accuracy * 100, improved ? " (best)" : ""
+		) << std::flush;
+		this->running.store(false, std::memory_order_release);
+	}
+
+	Img* imgs;
+	std::size_t n_imgs;
+	std::size_t patience;
+	std::function<T(const T&)>& activation;
+
+	std::unique_ptr<Net> snapshot;
+	std::unique_ptr<Net> best_net;
+	T best_loss = std::numeric_limits<T>::max();
+	std::size_t n_bad_validations = 0;
+
+	std::thread thread;
+	std::atomic<bool> running{false};
+	std::atomic<bool> stop{false};
+};
@@ -0,0 +1,228 @@
+#include "augment.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+#define IMAGE_CENTER_X ((IMAGE_WIDTH - 1) / 2.0f)
+#define IMAGE_CENTER_Y ((IMAGE_HEIGHT - 1) / 2.0f)
+// Half of the range [0, size + 3] the source coordinates, shifted by 2, are clamped to.
+#define IMAGE_PADDED_HALF_WIDTH ((IMAGE_WIDTH + 3) / 2.0f)
+#define IMAGE_PADDED_HALF_HEIGHT ((IMAGE_HEIGHT + 3) / 2.0f)
+
+// Separable gaussian blur of a IMAGE_HEIGHT x IMAGE_WIDTH field, zero padded.
+static void gaussian_blur(float* field, float sigma) {
+	int radius = (int)std::ceil(3 * sigma);
+	std::vector<float> kernel(2 * radius + 1);
+	float total = 0;
+	for(int k = -radius; k <= radius; k++) {
+		kernel[k + radius] = std::exp(-0.5f * k * k / (sigma * sigma));
+		total += kernel[k + radius];
+	}
+	for(float& k: kernel) {
+		k /= total;
+	}
+
+	float tmp[IMAGE_SIZE];
+	for(int y = 0; y < IMAGE_HEIGHT; y++) {
+		for(int x = 0; x < IMAGE_WIDTH; x++) {
+			float sum = 0;
+			for(int k = std::max(-radius, -x); k <= std::min(radius, IMAGE_WIDTH - 1 - x); k++) {
+				sum += kernel[k + radius] * field[y * IMAGE_WIDTH + x + k];
+			}
+			tmp[y * IMAGE_WIDTH + x] = sum;
+		}
+	}
+	// vertical pass row by row so the inner loop runs over contiguous pixels
+	for(int i = 0; i < IMAGE_SIZE; i++) {
+		field[i] = 0;
+	}
+	for(int y = 0; y < IMAGE_HEIGHT; y++) {
+		for(int k = std::max(-radius, -y); k <= std::min(radius, IMAGE_HEIGHT - 1 - y); k++) {
+			float weight = kernel[k + radius];
+			const float* src = tmp + (y + k) * IMAGE_WIDTH;
+			float* dst = field + y * IMAGE_WIDTH;
+			for(int x = 0; x < IMAGE_WIDTH; x++) {
+				dst[x] += weight * src[x];
+			}
+		}
+	}
+}
+
+void augment_img(const Img& src, Img& dst, const AugmentParams& params, std::size_t epoch, std::size_t index) {
+	std::seed_seq seed{ params.seed, (unsigned)epoch, (unsigned)index };
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(-1, 1);
+
+	// inverse of rotation * shear * scale, mapping every output pixel to the source pixel it comes from
+	float angle = unit(rng) * params.max_rotation;
+	float shear = unit(rng) * params.max_shear;
+	float scale = 1 + unit(rng) * params.max_scale;
+	float shift_x = unit(rng) * params.max_shift;
+	float shift_y = unit(rng) * params.max_shift;
+	float cos_a = std::cos(angle), sin_a = std::sin(angle);
+	float m00 = scale * cos_a, m01 = scale * (cos_a * shear - sin_a);
+	float m10 = scale * sin_a, m11 = scale * (sin_a * shear + cos_a);
+	float det = m00 * m11 - m01 * m10;
+	float i00 = m11 / det, i01 = -m01 / det;
+	float i10 = -m10 / det, i11 = m00 / det;
+
+	float dx[IMAGE_SIZE] = {};
+	float dy[IMAGE_SIZE] = {};
+	if(params.elastic_alpha != 0) {
+		for(int i = 0; i < IMAGE_SIZE; i++) {
+			dx[i] = unit(rng);
+			dy[i] = unit(rng);
+		}
+		gaussian_blur(dx, params.elastic_sigma);
+		gaussian_blur(dy, params.elastic_sigma);
+	}
+
+	float noise[IMAGE_SIZE] = {};
+	if(params.noise_stddev != 0) {
+		std::normal_distribution<float> gaussian(0, params.noise_stddev);
+		for(int i = 0; i < IMAGE_SIZE; i++) {
+			noise[i] = gaussian(rng);
+		}
+	}
+
+	// Sampling in passes that all vectorize: source coordinates, then the bilinear corners of every pixel
+	// (index and weight, the weight being zeroed outside of the image), then the gather, into a local buffer
+	// so that the compiler knows it doesn't alias the source, then the noise.
+	float src_x[IMAGE_SIZE], src_y[IMAGE_SIZE];
+	for(int y = 0; y < IMAGE_HEIGHT; y++) {
+		for(int x = 0; x < IMAGE_WIDTH; x++) {
+			int i = y * IMAGE_WIDTH + x;
+			float px = x - IMAGE_CENTER_X - shift_x;
+			float py = y - IMAGE_CENTER_Y - shift_y;
+			src_x[i] = IMAGE_CENTER_X + i00 * px + i01 * py + params.elastic_alpha * dx[i];
+			src_y[i] = IMAGE_CENTER_Y + i10 * px + i11 * py + params.elastic_alpha * dy[i];
+		}
+	}
+
+	int corners[4][IMAGE_SIZE];
+	float weights[4][IMAGE_SIZE];
+	for(int i = 0; i < IMAGE_SIZE; i++) {
+		// shifted by 2 and clamped to [0, size + 3] so that the int conversions floor them and can't overflow.
+		// The clamp is a single select on the distance to the middle of the range: GCC turns a min and a max
+		// into branches, and a branch keeps this loop over every pixel from vectorizing.
+		float sx = src_x[i] + 2 - IMAGE_PADDED_HALF_WIDTH;
+		float sy = src_y[i] + 2 - IMAGE_PADDED_HALF_HEIGHT;
+		float magnitude_x = std::fabs(sx), magnitude_y = std::fabs(sy);
+		magnitude_x = magnitude_x > IMAGE_PADDED_HALF_WIDTH ? IMAGE_PADDED_HALF_WIDTH : magnitude_x;
+		magnitude_y = magnitude_y > IMAGE_PADDED_HALF_HEIGHT ? IMAGE_PADDED_HALF_HEIGHT : magnitude_y;
+		sx = std::copysign(magnitude_x, sx) + IMAGE_PADDED_HALF_WIDTH;
+		sy = std::copysign(magnitude_y, sy) + IMAGE_PADDED_HALF_HEIGHT;
+		int x0 = (int)sx, y0 = (int)sy;
+		float wx = sx - x0;
+		float wy = sy - y0;
+		x0 -= 2;
+		y0 -= 2;
+		int x1 = x0 + 1, y1 = y0 + 1;
+		// pixels outside of the image are black
+		float vx0 = (float)((x0 >= 0) & (x0 < IMAGE_WIDTH));
+		float vx1 = (float)((x1 >= 0) & (x1 < IMAGE_WIDTH));
+		float vy0 = (float)((y0 >= 0) & (y0 < IMAGE_HEIGHT));
+		float vy1 = (float)((y1 >= 0) & (y1 < IMAGE_HEIGHT));
+		int cx0 = std::min(std::max(x0, 0), IMAGE_WIDTH - 1), cx1 = std::min(std::max(x1, 0), IMAGE_WIDTH - 1);
+		int cy0 = std::min(std::max(y0, 0), IMAGE_HEIGHT - 1), cy1 = std::min(std::max(y1, 0), IMAGE_HEIGHT - 1);
+		corners[0][i] = cy0 * IMAGE_WIDTH + cx0;
+		corners[1][i] = cy0 * IMAGE_WIDTH + cx1;
+		corners[2][i] = cy1 * IMAGE_WIDTH + cx0;
+		corners[3][i] = cy1 * IMAGE_WIDTH + cx1;
+		weights[0][i] = (1 - wx) * (1 - wy) * vx0 * vy0;
+		weights[1][i] = wx * (1 - wy) * vx1 * vy0;
+		weights[2][i] = (1 - wx) * wy * vx0 * vy1;
+		weights[3][i] = wx * wy * vx1 * vy1;
+	}
+
+	const float* in = src.img_data.raw_data();
+	float sampled[IMAGE_SIZE];
+	for(int i = 0; i < IMAGE_SIZE; i++) {
+		sampled[i] = weights[0][i] * in[corners[0][i]] + weights[1][i] * in[corners[1][i]]
+			+ weights[2][i] * in[corners[2][i]] + weights[3][i] * in[corners[3][i]];
+	}
+	float* out = dst.img_data.raw_data();
+	for(int i = 0; i < IMAGE_SIZE; i++) {
+		out[i] = std::min(std::max(sampled[i] + noise[i], 0.0f), 1.0f);
+	}
+	dst.label = src.label;
+}
+
+AugmentPipeline::AugmentPipeline(
+	Img* imgs,
+	std::size_t batch_size,
+	std::size_t mini_batch_size,
+	std::size_t epochs,
+	const AugmentParams& params,
+	std::size_t n_workers
+): imgs(imgs), mini_batch_size(mini_batch_size), n_workers(n_workers), params(params) {
+	if(mini_batch_size == 0 || n_workers == 0) {
+		throw std::invalid_argument("AugmentPipeline needs a non empty mini batch and at least one worker");
+	}
+	this->batches_per_epoch = batch_size / mini_batch_size;
+	this->n_batches = epochs * this->batches_per_epoch;
+	// one slot per worker plus the one held by the trainer
+	this->slots = std::vector<Slot>(n_workers + 1);
+	for(Slot& slot: this->slots) {
+		slot.imgs.resize(mini_batch_size);
+		slot.ready = false;
+	}
+	for(std::size_t i = 0; i < n_workers; i++) {
+		this->workers.emplace_back(&AugmentPipeline::worker, this, i);
+	}
+}
+
+AugmentPipeline::~AugmentPipeline() {
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stop = true;
+	}
+	this->free_cv.notify_all();
+	for(std::thread& worker: this->workers) {
+		worker.join();
+	}
+}
+
+Img* AugmentPipeline::next_batch() {
+	std::unique_lock<std::mutex> lock(this->mutex);
+	// hand the previous batch back
+	if(this->n_consumed > this->n_released) {
+		this->slots[this->n_released % this->slots.size()].ready = false;
+		this->n_released++;
+		this->free_cv.notify_all();
+	}
+	if(this->n_consumed == this->n_batches) {
+		return nullptr;
+	}
+	std::size_t batch_index = this->n_consumed;
+	Slot& slot = this->slots[batch_index % this->slots.size()];
+	this->ready_cv.wait(lock, [&]() { return slot.ready && slot.batch_index == batch_index; });
+	this->n_consumed++;
+	return slot.imgs.data();
+}
+
+void AugmentPipeline::worker(std::size_t worker_id) {
+	for(std::size_t batch_index = worker_id; batch_index < this->n_batches; batch_index += this->n_workers) {
+		Slot& slot = this->slots[batch_index % this->slots.size()];
+		{
+			std::unique_lock<std::mutex> lock(this->mutex);
+			this->free_cv.wait(lock, [&]() { return this->stop || batch_index < this->n_released + this->slots.size(); });
+			if(this->stop) {
+				return;
+			}
+		}
+		std::size_t epoch = batch_index / this->batches_per_epoch;
+		std::size_t first_img = (batch_index % this->batches_per_epoch) * this->mini_batch_size;
+		for(std::size_t i = 0; i < this->mini_batch_size; i++) {
+			augment_img(this->imgs[first_img + i], slot.imgs[i], this->params, epoch, first_img + i);
+		}
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			slot.batch_index = batch_index;
+			slot.ready = true;
+		}
+		this->ready_cv.notify_all();
+	}
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "img.hpp"
+
+// Ranges of the random transformations, each one being drawn uniformly in [-max, max].
+// Setting a field to 0 disables the matching transformation.
+struct AugmentParams {
+	float max_shift = 2;        // pixels
+	float max_rotation = 0.15;  // radians
+	float max_scale = 0.1;      // relative to the image size
+	float max_shear = 0.1;
+	float elastic_alpha = 34;   // displacement of the elastic distortion, in pixels before smoothing
+	float elastic_sigma = 4;    // smoothness of the elastic distortion
+	float noise_stddev = 0.05;  // gaussian noise added to every pixel
+	unsigned seed = 0;
+};
+
+// Write in dst a random affine warp + elastic distortion + noise of src.
+// The randomness only depends on (params.seed, epoch, index), so augmented images are reproducible
+// whatever the thread augmenting them.
+void augment_img(const Img& src, Img& dst, const AugmentParams& params, std::size_t epoch, std::size_t index);
+
+// Produce the augmented mini batches of every epoch on background threads, ahead of the trainer,
+// into a fixed ring of reusable buffers.
+// Mini batch i of an epoch is made of the images [i * mini_batch_size, (i + 1) * mini_batch_size) of imgs.
+// The workers are plain threads rather than jobs of the ThreadPool: a pool job blocks its caller until
+// it is done, so it can't run ahead of the training, and one issued while the training holds the pool
+// would run inline in the issuing thread anyway. Being unpinned, they compete with the pool threads
+// for the cores, the scheduler being free to move them to the hyperthreads the pool leaves unused;
+// n_workers should only be raised when the trainer waits on next_batch.
+class AugmentPipeline {
+public:
+	AugmentPipeline(
+		Img* imgs,
+		std::size_t batch_size,
+		std::size_t mini_batch_size,
+		std::size_t epochs,
+		const AugmentParams& params,
+		std::size_t n_workers = 1
+	);
+	~AugmentPipeline();
+
+	AugmentPipeline(const AugmentPipeline&) = delete;
+	AugmentPipeline& operator=(const AugmentPipeline&) = delete;
+
+	// Wait for the next augmented mini batch, in order, nullptr once every epoch has been consumed.
+	// The returned images stay valid until the following call.
+	Img* next_batch();
+
+private:
+	struct Slot {
+		std::vector<Img> imgs;
+		std::size_t batch_index;
+		bool ready;
+	};
+
+	void worker(std::size_t worker_id);
+
+	Img* imgs;
+	std::size_t mini_batch_size;
+	// stride of the workers over the batches, set before any of them starts
+	std::size_t n_workers;
+	std::size_t batches_per_epoch;
+	std::size_t n_batches;
+	AugmentParams params;
+
+	std::vector<Slot> slots;
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable ready_cv;
+	std::condition_variable free_cv;
+	// mini batches handed back by the trainer, their slot being free again
+	std::size_t n_released = 0;
+	std::size_t n_consumed = 0;
+	bool stop = false;
+};
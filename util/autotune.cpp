@@ -0,0 +1,117 @@
+#include "autotune.hpp"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+
+// "model name" of the first processor of /proc/cpuinfo.
+static std::string read_cpu_model() {
+	std::ifstream in("/proc/cpuinfo");
+	std::string line;
+	while(std::getline(in, line)) {
+		if(line.compare(0, 10, "model name") == 0) {
+			std::size_t colon = line.find(':');
+			if(colon != std::string::npos) {
+				std::string model = line.substr(line.find_first_not_of(' ', colon + 1));
+				std::replace(model.begin(), model.end(), '\t', ' ');
+				return model;
+			}
+		}
+	}
+	return "unknown";
+}
+
+Autotuner& Autotuner::instance() {
+	static Autotuner autotuner;
+	return autotuner;
+}
+
+Autotuner::Autotuner(): cur_mode(AUTOTUNE_CACHED), path(AUTOTUNE_DEFAULT_CACHE_FILE), model(read_cpu_model()) {
+	const char* env = getenv("NN_AUTOTUNE");
+	if(env != NULL && (strcmp(env, "0") == 0 || strcmp(env, "off") == 0)) {
+		this->cur_mode = AUTOTUNE_OFF;
+	} else if(env != NULL && (strcmp(env, "1") == 0 || strcmp(env, "tune") == 0)) {
+		this->cur_mode = AUTOTUNE_TUNE;
+	}
+	const char* cache_file = getenv("NN_TUNING_CACHE");
+	if(cache_file != NULL && cache_file[0] != '\0') {
+		this->path = cache_file;
+	}
+	load();
+}
+
+AutotuneMode Autotuner::mode() const {
+	return this->cur_mode.load(std::memory_order_relaxed);
+}
+
+void Autotuner::set_mode(AutotuneMode mode) {
+	this->cur_mode.store(mode, std::memory_order_relaxed);
+}
+
+const std::string& Autotuner::cpu_model() const {
+	return this->model;
+}
+
+DotConfig Autotuner::dot_config(const std::string& shape, const std::function<DotConfig()>& tune) {
+	std::lock_guard<std::mutex> lock(this->mutex);
+	AutotuneMode mode = this->mode();
+	if(mode == AUTOTUNE_OFF) {
+		return DotConfig();
+	}
+	std::string key = this->model + '\t' + shape;
+	auto it = this->cache.find(key);
+	if(it != this->cache.end()) {
+		return it->second;
+	}
+	if(mode != AUTOTUNE_TUNE) {
+		return DotConfig();
+	}
+	DotConfig config = tune();
+	this->cache[key] = config;
+	save();
+	return config;
+}
+
+// One "cpu model\tshape\torder split tile_k tile_j" line per entry.
+void Autotuner::load() {
+	std::ifstream in(this->path);
+	std::string line;
+	while(std::getline(in, line)) {
+		std::size_t model_end = line.find('\t');
+		std::size_t shape_end = model_end == std::string::npos ? std::string::npos : line.find('\t', model_end + 1);
+		if(shape_end == std::string::npos) {
+			continue;
+		}
+		int order, split;
+		DotConfig config;
+		if(sscanf(line.c_str() + shape_end + 1, "%d %d %lu %lu", &order, &split, &config.tile_k, &config.tile_j) != 4
+			|| order < DOT_ORDER_ROWS || order > DOT_ORDER_TILES || split < DOT_SPLIT_ROWS || split > DOT_SPLIT_NONE) {
+			continue;
+		}
+		config.order = (DotOrder)order;
+		config.split = (DotSplit)split;
+		this->cache[line.substr(0, shape_end)] = config;
+	}
+}
+
+// Written to a temporary file then renamed, so a concurrent run never reads a partial cache.
+// A cache that can't be written only costs the tuning of the next run, hence a warning.
+void Autotuner::save() const {
+	std::string tmp_path = this->path + ".tmp";
+	FILE* fp = fopen(tmp_path.c_str(), "w");
+	if(fp == NULL) {
+		fprintf(stderr, "Unable to write the tuning cache %s\n", tmp_path.c_str());
+		return;
+	}
+	for(const auto& entry: this->cache) {
+		const DotConfig& config = entry.second;
+		fprintf(fp, "%s\t%d %d %lu %lu\n", entry.first.c_str(), (int)config.order, (int)config.split, config.tile_k, config.tile_j);
+	}
+	fclose(fp);
+	if(rename(tmp_path.c_str(), this->path.c_str()) != 0) {
+		fprintf(stderr, "Unable to write the tuning cache %s\n", this->path.c_str());
+	}
+}
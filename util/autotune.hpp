@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#define AUTOTUNE_DEFAULT_CACHE_FILE "./tuning_cache"
+
+enum AutotuneMode {
+	AUTOTUNE_OFF,     // always the default kernels, the cache being ignored
+	AUTOTUNE_CACHED,  // the cached kernels when known, the default ones otherwise
+	AUTOTUNE_TUNE     // shapes missing from the cache are tuned on first use and saved
+};
+
+enum DotOrder {
+	DOT_ORDER_ROWS,   // i, j tile, k, j: one tile of an output row at a time
+	DOT_ORDER_TILES   // j tile, k tile, i, k, j: a tile of rhs reused by every row
+};
+
+enum DotSplit {
+	DOT_SPLIT_ROWS,   // threads working on different rows of the output
+	DOT_SPLIT_COLS,   // threads working on different columns, for the outputs with fewer rows than threads
+	DOT_SPLIT_NONE    // a single thread, as every split is when the dot runs inside the thread pool
+};
+
+// Kernel of Matrix::dot, a tile of 0 spanning the whole dimension.
+struct DotConfig {
+	DotOrder order = DOT_ORDER_ROWS;
+	DotSplit split = DOT_SPLIT_ROWS;
+	std::size_t tile_k = 0;
+	std::size_t tile_j = 0;
+
+	bool operator==(const DotConfig& other) const {
+		return this->order == other.order && this->split == other.split
+			&& this->tile_k == other.tile_k && this->tile_j == other.tile_j;
+	}
+};
+
+// Process wide cache of the fastest kernel per shape, created on first use.
+// Its mode comes from NN_AUTOTUNE ("0"/"off", "1"/"tune", cached otherwise) and its file from
+// NN_TUNING_CACHE (AUTOTUNE_DEFAULT_CACHE_FILE otherwise), entries being keyed by the CPU model
+// so that one file can be shared between machines.
+class Autotuner {
+public:
+	static Autotuner& instance();
+
+	Autotuner(const Autotuner&) = delete;
+	Autotuner& operator=(const Autotuner&) = delete;
+
+	// Lock free, read by every Matrix::dot before anything else.
+	AutotuneMode mode() const;
+	void set_mode(AutotuneMode mode);
+
+	// Kernel for shape, calling tune (at most once per shape, under the lock) when in tune mode
+	// and the shape isn't cached yet.
+	DotConfig dot_config(const std::string& shape, const std::function<DotConfig()>& tune);
+
+	const std::string& cpu_model() const;
+
+private:
+	Autotuner();
+
+	void load();
+	void save() const;
+
+	std::atomic<AutotuneMode> cur_mode;
+	std::string path;
+	std::string model;
+	// "cpu model\tshape" to kernel, the entries of the other CPU models being kept when saving
+	std::map<std::string, DotConfig> cache;
+	std::mutex mutex;
+};
@@ -1,4 +1,5 @@
 #include "img.hpp"
+#include "thread_pool.hpp"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +14,8 @@
 int csv_to_imgs(Img** imgs_array, const char* file_string, size_t number_of_imgs) {
 	FILE *fp;
 	Img* imgs = (Img*)malloc(number_of_imgs * sizeof(Img));
+	// spread the pages between the NUMA nodes of the pool threads instead of the node of the loading thread
+	ThreadPool::instance().first_touch(imgs, number_of_imgs * sizeof(Img));
 	char row[MAXCHAR];
 	fp = fopen(file_string, "r");
 	
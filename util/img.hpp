@@ -2,7 +2,9 @@
 
 #include "../matrix/vector.hpp"
 
-#define IMAGE_SIZE (28 * 28)
+#define IMAGE_WIDTH 28
+#define IMAGE_HEIGHT 28
+#define IMAGE_SIZE (IMAGE_WIDTH * IMAGE_HEIGHT)
 
 typedef struct {
 	Vector<float, IMAGE_SIZE> img_data;
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Row view of the partial results of ThreadPool::parallel_reduce, so that summing the partials can be split
+// between threads: partial_rows(x) is the number of rows of x and add_partial_rows(out, in, begin, end)
+// adds the rows [begin, end) of in to out.
+// An arithmetic value is a single row, a tuple the rows of its elements one after the other.
+// Vector and Matrix provide their own overloads, found through argument dependent lookup.
+
+template<typename R>
+typename std::enable_if<std::is_arithmetic<R>::value, std::size_t>::type partial_rows(const R&) {
+	return 1;
+}
+
+template<typename R>
+typename std::enable_if<std::is_arithmetic<R>::value>::type add_partial_rows(R& out, const R& in, std::size_t begin, std::size_t end) {
+	if(begin == 0 && end > 0) {
+		out += in;
+	}
+}
+
+template<typename... Ts>
+std::size_t partial_rows(const std::tuple<Ts...>& tuple);
+
+template<typename... Ts>
+void add_partial_rows(std::tuple<Ts...>& out, const std::tuple<Ts...>& in, std::size_t begin, std::size_t end);
+
+// Add the rows of [begin, end) falling in the element, its rows starting at row offset of the tuple.
+template<typename E>
+void add_tuple_element_rows(E& out, const E& in, std::size_t begin, std::size_t end, std::size_t& offset) {
+	std::size_t rows = partial_rows(out);
+	std::size_t element_begin = std::max(begin, offset);
+	std::size_t element_end = std::min(end, offset + rows);
+	if(element_begin < element_end) {
+		add_partial_rows(out, in, element_begin - offset, element_end - offset);
+	}
+	offset += rows;
+}
+
+template<typename Tuple, std::size_t... I>
+void add_tuple_rows(Tuple& out, const Tuple& in, std::size_t begin, std::size_t end, std::index_sequence<I...>) {
+	std::size_t offset = 0;
+	(add_tuple_element_rows(std::get<I>(out), std::get<I>(in), begin, end, offset), ...);
+}
+
+template<typename... Ts>
+std::size_t partial_rows(const std::tuple<Ts...>& tuple) {
+	return std::apply([](const Ts&... elements) {
+		return ((std::size_t)0 + ... + partial_rows(elements));
+	}, tuple);
+}
+
+template<typename... Ts>
+void add_partial_rows(std::tuple<Ts...>& out, const std::tuple<Ts...>& in, std::size_t begin, std::size_t end) {
+	add_tuple_rows(out, in, begin, end, std::index_sequence_for<Ts...>());
+}
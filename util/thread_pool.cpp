@@ -0,0 +1,232 @@
+#include "thread_pool.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#define MAX_NUMA_NODES 256
+
+// Set in the pool threads, in a thread issuing a job and in background threads, their parallel_for calls running inline.
+static thread_local bool inside_pool = false;
+
+// Parse a sysfs cpu list such as "0-3,8-11".
+static std::vector<int> parse_cpu_list(const char* path) {
+	std::vector<int> out;
+	FILE* fp = fopen(path, "r");
+	if(fp == NULL) {
+		return out;
+	}
+	int first, last;
+	while(fscanf(fp, "%d", &first) == 1) {
+		last = first;
+		int c = fgetc(fp);
+		if(c == '-') {
+			if(fscanf(fp, "%d", &last) != 1) {
+				break;
+			}
+			c = fgetc(fp);
+		}
+		for(int cpu = first; cpu <= last; cpu++) {
+			out.push_back(cpu);
+		}
+		if(c != ',') {
+			break;
+		}
+	}
+	fclose(fp);
+	return out;
+}
+
+// One cpu per physical core the process may run on, ordered NUMA node by node.
+static std::vector<int> physical_cpus() {
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return std::vector<int>();
+	}
+
+	std::vector<int> ordered;
+	char path[128];
+	for(int node = 0; node < MAX_NUMA_NODES; node++) {
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		std::vector<int> node_cpus = parse_cpu_list(path);
+		ordered.insert(ordered.end(), node_cpus.begin(), node_cpus.end());
+	}
+	if(ordered.empty()) {
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			ordered.push_back(cpu);
+		}
+	}
+
+	std::vector<int> out;
+	for(int cpu: ordered) {
+		if(cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+			continue;
+		}
+		// only keep the first hyperthread of every core
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+		std::vector<int> siblings = parse_cpu_list(path);
+		if(!siblings.empty() && siblings[0] != cpu && CPU_ISSET(siblings[0], &allowed)) {
+			continue;
+		}
+		out.push_back(cpu);
+	}
+	return out;
+}
+
+ThreadPool& ThreadPool::instance() {
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool::ThreadPool(): remaining_blocks(0) {
+	this->cpus = physical_cpus();
+	std::size_t n_threads = this->cpus.size();
+	const char* env_threads = getenv("NN_NUM_THREADS");
+	if(env_threads != NULL && atoi(env_threads) > 0) {
+		n_threads = atoi(env_threads);
+	}
+	if(n_threads == 0) {
+		n_threads = 1;
+	}
+	// pinning more threads than cores would stack them on the same cores
+	if(n_threads > this->cpus.size()) {
+		this->cpus.clear();
+	}
+
+	this->queues = std::vector<WorkStealingQueue<std::size_t>>(n_threads);
+	for(std::size_t i = 1; i < n_threads; i++) {
+		this->workers.emplace_back(&ThreadPool::worker_loop, this, i);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(this->state_mutex);
+		this->stop = true;
+	}
+	this->job_cv.notify_all();
+	for(std::thread& worker: this->workers) {
+		worker.join();
+	}
+}
+
+std::size_t ThreadPool::size() const {
+	return this->queues.size();
+}
+
+std::size_t ThreadPool::grain_for(std::size_t work_per_item) {
+	return std::max((std::size_t)1, PARALLEL_MIN_WORK / std::max((std::size_t)1, work_per_item));
+}
+
+std::size_t ThreadPool::available_threads() const {
+	return inside_pool ? 1 : this->size();
+}
+
+void ThreadPool::run_inline_in_this_thread() {
+	inside_pool = true;
+}
+
+void ThreadPool::parallel_for(std::size_t n, const std::function<void(std::size_t, std::size_t)>& func, std::size_t grain) {
+	run_blocks(n, block_count(n, grain), [&](std::size_t, std::size_t begin, std::size_t end) {
+		func(begin, end);
+	});
+}
+
+void ThreadPool::first_touch(void* data, std::size_t bytes) {
+	char* bytes_data = (char*)data;
+	parallel_for(bytes, [&](std::size_t begin, std::size_t end) {
+		memset(bytes_data + begin, 0, end - begin);
+	}, PARALLEL_MIN_WORK);
+}
+
+std::size_t ThreadPool::block_count(std::size_t n, std::size_t grain) const {
+	if(this->size() == 1) {
+		return n == 0 ? 0 : 1;
+	}
+	std::size_t max_blocks = (n + grain - 1) / std::max((std::size_t)1, grain);
+	return std::min(max_blocks, this->size() * PARALLEL_BLOCKS_PER_THREAD);
+}
+
+void ThreadPool::run_blocks(std::size_t n, std::size_t n_blocks, const BlockFunc& func) {
+	if(n_blocks == 0) {
+		return;
+	}
+	if(n_blocks == 1 || inside_pool || !this->busy.try_lock()) {
+		for(std::size_t block = 0; block < n_blocks; block++) {
+			func(0, n * block / n_blocks, n * (block + 1) / n_blocks);
+		}
+		return;
+	}
+	std::lock_guard<std::mutex> busy_lock(this->busy, std::adopt_lock);
+
+	this->job = &func;
+	this->job_size = n;
+	this->job_blocks = n_blocks;
+	this->job_error = nullptr;
+	this->remaining_blocks = n_blocks;
+	for(std::size_t block = 0; block < n_blocks; block++) {
+		this->queues[block * this->size() / n_blocks].push(block);
+	}
+	{
+		std::lock_guard<std::mutex> lock(this->state_mutex);
+		this->generation++;
+	}
+	this->job_cv.notify_all();
+
+	inside_pool = true;
+	work(0);
+	inside_pool = false;
+
+	std::unique_lock<std::mutex> lock(this->state_mutex);
+	this->done_cv.wait(lock, [&]() { return this->remaining_blocks == 0; });
+	this->job = nullptr;
+	if(this->job_error) {
+		std::rethrow_exception(this->job_error);
+	}
+}
+
+void ThreadPool::work(std::size_t thread_id) {
+	std::size_t block;
+	while(pop_or_steal(this->queues, thread_id, block)) {
+		// the job can't change before every popped block is done
+		try {
+			(*this->job)(thread_id, this->job_size * block / this->job_blocks, this->job_size * (block + 1) / this->job_blocks);
+		} catch(...) {
+			std::lock_guard<std::mutex> lock(this->state_mutex);
+			if(!this->job_error) {
+				this->job_error = std::current_exception();
+			}
+		}
+		if(--this->remaining_blocks == 0) {
+			std::lock_guard<std::mutex> lock(this->state_mutex);
+			this->done_cv.notify_all();
+		}
+	}
+}
+
+void ThreadPool::worker_loop(std::size_t thread_id) {
+	inside_pool = true;
+	if(thread_id < this->cpus.size()) {
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(this->cpus[thread_id], &cpu_set);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+	}
+	std::size_t seen_generation = 0;
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lock(this->state_mutex);
+			this->job_cv.wait(lock, [&]() { return this->stop || this->generation != seen_generation; });
+			if(this->stop) {
+				return;
+			}
+			seen_generation = this->generation;
+		}
+		work(thread_id);
+	}
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "reduce.hpp"
+#include "work_queue.hpp"
+
+// Below this many multiply-adds a kernel isn't worth splitting between threads.
+#define PARALLEL_MIN_WORK 32768
+// Blocks per thread, the extra ones being there to be stolen by the threads finishing first.
+#define PARALLEL_BLOCKS_PER_THREAD 4
+
+// Persistent pool shared by every parallel kernel of the library, created on first use with one thread
+// per physical core available to the process (or NN_NUM_THREADS threads), the calling thread included.
+// Worker threads are pinned to their core, cores being ordered NUMA node by node so that neighbouring
+// blocks of a parallel_for, and the pages first touched by them, stay on the same node.
+class ThreadPool {
+public:
+	static ThreadPool& instance();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	~ThreadPool();
+
+	// Number of threads working on a parallel_for, the calling thread included.
+	std::size_t size() const;
+
+	// Call func(begin, end) on contiguous blocks of [0, n) of at least grain elements.
+	// Thread t first runs the blocks of the t-th slice of [0, n), then steals the remaining blocks of the others.
+	// Nested or concurrent calls, issued while the pool is busy, run every block in the calling thread.
+	void parallel_for(std::size_t n, const std::function<void(std::size_t, std::size_t)>& func, std::size_t grain = 1);
+
+	// Call map(partial, begin, end) on contiguous blocks of [0, n) of at least grain elements, scheduled like
+	// parallel_for (more blocks than threads, the idle threads stealing the blocks of the others), every thread
+	// accumulating the blocks it runs into its own value initialized (zeroed for matrices and arithmetic types)
+	// partial result, allocated and zeroed by that thread on its first block.
+	// The partials, at most one per thread, are then summed in parallel over their rows (see add_partial_rows).
+	// Which thread runs which block depends on the scheduling, so floating point results may differ in
+	// their last bits from one call to the next.
+	// R is an arithmetic type, a Vector, a Matrix or a tuple of those. Partials live on the heap,
+	// the accumulated matrices being too large for the thread stacks.
+	template<typename R, typename Map>
+	R parallel_reduce(std::size_t n, Map map, std::size_t grain = 1) {
+		if(n == 0) {
+			return R();
+		}
+		std::vector<std::unique_ptr<R>> thread_partials(this->size());
+		run_blocks(n, block_count(n, grain), [&](std::size_t thread_id, std::size_t begin, std::size_t end) {
+			std::unique_ptr<R>& partial = thread_partials[thread_id];
+			if(!partial) {
+				partial.reset(new R());
+			}
+			map(*partial, begin, end);
+		});
+		std::vector<R*> partials;
+		for(std::unique_ptr<R>& partial: thread_partials) {
+			if(partial) {
+				partials.push_back(partial.get());
+			}
+		}
+		R& out = *partials[0];
+		if(partials.size() > 1) {
+			std::size_t rows = partial_rows(out);
+			// the bytes of the partials read per row as the work estimate
+			parallel_for(rows, [&](std::size_t begin, std::size_t end) {
+				for(std::size_t part = 1; part < partials.size(); part++) {
+					add_partial_rows(out, *partials[part], begin, end);
+				}
+			}, grain_for((partials.size() - 1) * sizeof(R) / rows));
+		}
+		return out;
+	}
+
+	// Write zeroes to data with the same split as parallel_for, so that on NUMA machines the pages get
+	// allocated on the node of the threads that will later work on them (first touch policy).
+	void first_touch(void* data, std::size_t bytes);
+
+	// Elements per block for items costing work_per_item multiply-adds each.
+	static std::size_t grain_for(std::size_t work_per_item);
+
+	// Threads a parallel_for issued by the calling thread would use, 1 when it would run inline.
+	std::size_t available_threads() const;
+
+	// Run every parallel call of the calling thread inline, for background threads (e.g. validation)
+	// that must not take the pool from the training.
+	static void run_inline_in_this_thread();
+
+private:
+	// func(thread_id, begin, end), thread_id being the index of the thread running the block,
+	// 0 for the blocks run inline by the calling thread.
+	typedef std::function<void(std::size_t, std::size_t, std::size_t)> BlockFunc;
+
+	ThreadPool();
+
+	std::size_t block_count(std::size_t n, std::size_t grain) const;
+	void run_blocks(std::size_t n, std::size_t n_blocks, const BlockFunc& func);
+	void work(std::size_t thread_id);
+	void worker_loop(std::size_t thread_id);
+
+	std::vector<int> cpus;
+	std::vector<std::thread> workers;
+	std::vector<WorkStealingQueue<std::size_t>> queues;
+
+	// held by the thread issuing the current job
+	std::mutex busy;
+
+	std::mutex state_mutex;
+	std::condition_variable job_cv;
+	std::condition_variable done_cv;
+	std::size_t generation = 0;
+	bool stop = false;
+
+	const BlockFunc* job = nullptr;
+	std::size_t job_size = 0;
+	std::size_t job_blocks = 0;
+	std::atomic<std::size_t> remaining_blocks;
+	std::exception_ptr job_error;
+};
@@ -0,0 +1,153 @@
+#include "transport.hpp"
+#include "../matrix/vector.hpp"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#define CONNECT_RETRIES 600
+#define CONNECT_RETRY_DELAY_MS 100
+
+static std::runtime_error socket_error(const char* what) {
+	return std::runtime_error(string_format("TcpTransport: %s failed (%s)", what, strerror(errno)));
+}
+
+static void set_socket_options(int fd) {
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static sockaddr_in make_address(const char* host, int port) {
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+		throw std::invalid_argument(string_format("TcpTransport: invalid host address %s", host));
+	}
+	return addr;
+}
+
+TcpTransport::TcpTransport(std::size_t rank, std::size_t world_size, const char* host, int base_port):
+	cur_rank(rank), n_ranks(world_size) {
+	if(rank >= world_size) {
+		throw std::invalid_argument(string_format("TcpTransport: rank %lu out of a world of size %lu", rank, world_size));
+	}
+	if(world_size == 1) {
+		return;
+	}
+
+	int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(listen_fd < 0) {
+		throw socket_error("socket");
+	}
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in listen_addr = make_address(host, base_port + rank);
+	if(bind(listen_fd, (sockaddr*)&listen_addr, sizeof(listen_addr)) < 0 || listen(listen_fd, 1) < 0) {
+		close(listen_fd);
+		throw socket_error("bind");
+	}
+
+	// every rank listens before connecting, the connection completing in the backlog of the next rank
+	sockaddr_in next_addr = make_address(host, base_port + (rank + 1) % world_size);
+	for(std::size_t i = 0; this->next_fd < 0; i++) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if(fd < 0) {
+			close(listen_fd);
+			throw socket_error("socket");
+		}
+		if(connect(fd, (sockaddr*)&next_addr, sizeof(next_addr)) == 0) {
+			this->next_fd = fd;
+			break;
+		}
+		close(fd);
+		if(i == CONNECT_RETRIES) {
+			close(listen_fd);
+			throw socket_error("connect");
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(CONNECT_RETRY_DELAY_MS));
+	}
+
+	this->prev_fd = accept(listen_fd, nullptr, nullptr);
+	close(listen_fd);
+	if(this->prev_fd < 0) {
+		close(this->next_fd);
+		throw socket_error("accept");
+	}
+	set_socket_options(this->next_fd);
+	set_socket_options(this->prev_fd);
+}
+
+TcpTransport::~TcpTransport() {
+	if(this->next_fd >= 0) {
+		close(this->next_fd);
+	}
+	if(this->prev_fd >= 0) {
+		close(this->prev_fd);
+	}
+}
+
+std::size_t TcpTransport::rank() const {
+	return this->cur_rank;
+}
+
+std::size_t TcpTransport::world_size() const {
+	return this->n_ranks;
+}
+
+void TcpTransport::exchange(const void* send_buf, std::size_t send_size, void* recv_buf, std::size_t recv_size) {
+	// sending and receiving at the same time, blocking sends of large chunks would deadlock the ring
+	// once the socket buffers are full
+	const char* to_send = (const char*)send_buf;
+	char* to_recv = (char*)recv_buf;
+	while(send_size > 0 || recv_size > 0) {
+		pollfd fds[2];
+		nfds_t n_fds = 0;
+		if(send_size > 0) {
+			fds[n_fds++] = { this->next_fd, POLLOUT, 0 };
+		}
+		if(recv_size > 0) {
+			fds[n_fds++] = { this->prev_fd, POLLIN, 0 };
+		}
+		if(poll(fds, n_fds, -1) < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			throw socket_error("poll");
+		}
+		if(send_size > 0) {
+			ssize_t sent = send(this->next_fd, to_send, send_size, MSG_NOSIGNAL);
+			if(sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				throw socket_error("send");
+			}
+			if(sent > 0) {
+				to_send += sent;
+				send_size -= sent;
+			}
+		}
+		if(recv_size > 0) {
+			ssize_t received = recv(this->prev_fd, to_recv, recv_size, 0);
+			if(received == 0) {
+				throw std::runtime_error("TcpTransport: previous rank closed the connection");
+			}
+			if(received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				throw socket_error("recv");
+			}
+			if(received > 0) {
+				to_recv += received;
+				recv_size -= received;
+			}
+		}
+	}
+}
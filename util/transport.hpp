@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Point to point link between the processes of a ring, rank r sending to rank (r + 1) % world_size
+// and receiving from rank (r - 1) % world_size.
+class Transport {
+public:
+	virtual ~Transport() = default;
+
+	virtual std::size_t rank() const = 0;
+	virtual std::size_t world_size() const = 0;
+
+	// Send send_size bytes to the next rank while receiving recv_size bytes from the previous one,
+	// either size can be 0 to only send or only receive.
+	virtual void exchange(const void* send_buf, std::size_t send_size, void* recv_buf, std::size_t recv_size) = 0;
+};
+
+// Ring over TCP sockets, rank r listening on base_port + r of host.
+class TcpTransport: public Transport {
+public:
+	TcpTransport(std::size_t rank, std::size_t world_size, const char* host, int base_port);
+	~TcpTransport();
+
+	TcpTransport(const TcpTransport&) = delete;
+	TcpTransport& operator=(const TcpTransport&) = delete;
+
+	std::size_t rank() const override;
+	std::size_t world_size() const override;
+
+	void exchange(const void* send_buf, std::size_t send_size, void* recv_buf, std::size_t recv_size) override;
+
+private:
+	std::size_t cur_rank;
+	std::size_t n_ranks;
+	int next_fd = -1;
+	int prev_fd = -1;
+};
+
+// Sum data element wise across every rank, each rank ending up with the same bits.
+// Reduce-scatter then all-gather around the ring, every rank only sending 2 * (world_size - 1) / world_size of data.
+template<typename T>
+void ring_all_reduce(Transport& transport, T* data, std::size_t n) {
+	std::size_t world_size = transport.world_size();
+	if(world_size == 1) {
+		return;
+	}
+	std::size_t rank = transport.rank();
+	auto chunk_start = [&](std::size_t chunk) { return n * chunk / world_size; };
+	auto chunk_size = [&](std::size_t chunk) { return chunk_start(chunk + 1) - chunk_start(chunk); };
+
+	std::vector<T> recv_buf(n / world_size + 1);
+	for(std::size_t step = 0; step < world_size - 1; step++) {
+		std::size_t send_chunk = (rank + world_size - step) % world_size;
+		std::size_t recv_chunk = (rank + world_size - step - 1) % world_size;
+		transport.exchange(
+			data + chunk_start(send_chunk), sizeof(T) * chunk_size(send_chunk),
+			recv_buf.data(), sizeof(T) * chunk_size(recv_chunk)
+		);
+		T* reduced = data + chunk_start(recv_chunk);
+		for(std::size_t i = 0; i < chunk_size(recv_chunk); i++) {
+			reduced[i] += recv_buf[i];
+		}
+	}
+	// rank now owns the fully reduced chunk (rank + 1) % world_size
+	for(std::size_t step = 0; step < world_size - 1; step++) {
+		std::size_t send_chunk = (rank + world_size + 1 - step) % world_size;
+		std::size_t recv_chunk = (rank + world_size - step) % world_size;
+		transport.exchange(
+			data + chunk_start(send_chunk), sizeof(T) * chunk_size(send_chunk),
+			data + chunk_start(recv_chunk), sizeof(T) * chunk_size(recv_chunk)
+		);
+	}
+}
+
+// Copy the data of rank 0 to every other rank.
+template<typename T>
+void ring_broadcast(Transport& transport, T* data, std::size_t n) {
+	std::size_t world_size = transport.world_size();
+	std::size_t rank = transport.rank();
+	if(rank != 0) {
+		transport.exchange(nullptr, 0, data, sizeof(T) * n);
+	}
+	if(rank != world_size - 1) {
+		transport.exchange(data, sizeof(T) * n, nullptr, 0);
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Per worker queue of work items, its owner popping from the front while idle workers steal from the back.
+template<typename T>
+class WorkStealingQueue {
+public:
+	void push(const T& item) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->items.push_back(item);
+	}
+
+	bool pop(T& item) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if(this->items.empty()) {
+			return false;
+		}
+		item = this->items.front();
+		this->items.pop_front();
+		return true;
+	}
+
+	bool steal(T& item) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if(this->items.empty()) {
+			return false;
+		}
+		item = this->items.back();
+		this->items.pop_back();
+		return true;
+	}
+
+private:
+	std::deque<T> items;
+	std::mutex mutex;
+};
+
+// Take the next item of worker owner, stealing from the other queues once its own is empty.
+// Returns false when every queue is empty.
+template<typename T>
+bool pop_or_steal(std::vector<WorkStealingQueue<T>>& queues, std::size_t owner, T& item) {
+	if(queues[owner].pop(item)) {
+		return true;
+	}
+	for(std::size_t i = 1; i < queues.size(); i++) {
+		if(queues[(owner + i) % queues.size()].steal(item)) {
+			return true;
+		}
+	}
+	return false;
+}